@@ -0,0 +1,466 @@
+#ifndef bench_h
+#define bench_h
+
+/*  A small benchmark harness: runs each registered case over a sweep of
+    problem sizes and thread counts, and reports for each combination the
+    mean time with a 95% confidence interval, throughput, speedup over one
+    thread and parallel efficiency. Results can be written as JSON and
+    compared against a stored baseline, flagging regressions.
+
+        bench::suite suite(options);
+
+        suite.add("energy", {500, 1000, 2000}, [](size_t n)
+        {
+            auto a = create_random_points(n);            // set-up, not timed
+            auto b = create_random_points(n);
+
+            return bench::timed(double(n) * n, [=]()     // elements per run
+            {
+                energy::mapreduce_energy(a, b);          // timed
+            });
+        });
+
+        return suite.run();
+
+    Thread counts are applied through tbb::global_control and, when built
+    with OpenMP, omp_set_num_threads, so both kinds of kernel follow them.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <tbb/global_control.h>
+#include <tbb/info.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace bench
+{
+
+/** What to run and where to write the results */
+struct options
+{
+    options() : reps(5), threshold(0.05)
+    {}
+
+    std::vector<int> threads;    // empty means 1, 2, 4, ... up to the core count
+    int reps;                    // timed repetitions per measurement
+    double threshold;            // relative slow-down counted as a regression
+    bool quick = false;          // only run the smallest size of each case
+    std::string filter;          // only run cases whose name contains this
+    std::string json;            // file to write results to
+    std::string baseline;        // file of results to compare against
+};
+
+/** One prepared run: the number of elements it processes and the code to time */
+struct timed
+{
+    timed(double elements, std::function<void()> func) : elements(elements), func(func)
+    {}
+
+    double elements;
+    std::function<void()> func;
+};
+
+/** The measurements for one case, size and thread count */
+struct result
+{
+    std::string name;
+    size_t size;
+    int threads;
+    double mean, ci95, min;
+    double throughput, speedup, efficiency;
+};
+
+namespace detail
+{
+    /** Two-sided 95% quantile of Student's t with 'df' degrees of freedom */
+    inline double t95(int df)
+    {
+        static const double table[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365,
+                                        2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145,
+                                        2.131, 2.120, 2.110, 2.101, 2.093, 2.086 };
+
+        if (df < 1)
+        {
+            return 0.0;
+        }
+        else if (df <= 20)
+        {
+            return table[df-1];
+        }
+        else if (df <= 30)
+        {
+            return 2.042;
+        }
+
+        return 1.960;
+    }
+
+    /** Return the default thread sweep: 1, 2, 4, ... and the core count */
+    inline std::vector<int> default_threads()
+    {
+        int maxthreads = tbb::info::default_concurrency();
+
+        std::vector<int> threads;
+
+        for (int t=1; t<maxthreads; t*=2)
+        {
+            threads.push_back(t);
+        }
+
+        threads.push_back(maxthreads);
+
+        return threads;
+    }
+
+    /** Return the value of "key": in a line of JSON written by write_json */
+    inline std::string json_field(const std::string &line, const std::string &key)
+    {
+        auto pos = line.find("\"" + key + "\":");
+
+        if (pos == std::string::npos)
+        {
+            return std::string();
+        }
+
+        pos += key.size() + 3;
+
+        auto end = line.find_first_of(",}", pos);
+
+        std::string value = line.substr(pos, end - pos);
+
+        value.erase(std::remove(value.begin(), value.end(), '"'), value.end());
+
+        return value;
+    }
+
+    inline std::string key(const std::string &name, size_t size, int threads)
+    {
+        std::ostringstream os;
+        os << name << "/" << size << "/" << threads;
+        return os.str();
+    }
+}
+
+/** Parse the command-line flags understood by suite::run */
+inline options parse_options(int argc, char **argv)
+{
+    options opts;
+
+    for (int i=1; i<argc; ++i)
+    {
+        std::string arg = argv[i];
+        std::string value = (i+1 < argc) ? argv[i+1] : "";
+
+        if (arg == "--quick")
+        {
+            opts.quick = true;
+            continue;
+        }
+        else if (arg == "--threads")
+        {
+            std::istringstream is(value);
+            std::string t;
+
+            while (std::getline(is, t, ','))
+            {
+                opts.threads.push_back(std::atoi(t.c_str()));
+            }
+        }
+        else if (arg == "--reps")
+        {
+            opts.reps = std::max(2, std::atoi(value.c_str()));
+        }
+        else if (arg == "--threshold")
+        {
+            opts.threshold = std::atof(value.c_str());
+        }
+        else if (arg == "--filter")
+        {
+            opts.filter = value;
+        }
+        else if (arg == "--json")
+        {
+            opts.json = value;
+        }
+        else if (arg == "--baseline")
+        {
+            opts.baseline = value;
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--threads 1,2,4] [--reps n] [--quick]"
+                      << " [--filter name] [--json out.json] [--baseline base.json]"
+                      << " [--threshold 0.05]" << std::endl;
+            std::exit(-1);
+        }
+
+        ++i;
+    }
+
+    return opts;
+}
+
+/** A collection of benchmark cases */
+class suite
+{
+public:
+    typedef std::function<timed(size_t)> setup_func;
+
+    suite(const options &opts) : opts(opts)
+    {
+        if (this->opts.threads.empty())
+        {
+            this->opts.threads = detail::default_threads();
+        }
+    }
+
+    /** Add a case called 'name' run at each of 'sizes'. 'setup(size)' prepares
+        the data (untimed) and returns the timed work */
+    void add(const std::string &name, const std::vector<size_t> &sizes, setup_func setup)
+    {
+        cases.push_back(std::make_tuple(name, sizes, setup));
+    }
+
+    /** Run every case, print and save the results, and compare against the
+        baseline. Returns the number of regressions found (0 for success), or
+        -1 if the baseline can't be read */
+    int run()
+    {
+        std::printf("%-24s %10s %7s %12s %10s %14s %8s %6s\n", "case", "size", "threads",
+                    "mean (s)", "+/- 95%", "elements/s", "speedup", "eff");
+
+        for (const auto &c : cases)
+        {
+            const std::string &name = std::get<0>(c);
+
+            if (!opts.filter.empty() && name.find(opts.filter) == std::string::npos)
+            {
+                continue;
+            }
+
+            auto sizes = std::get<1>(c);
+
+            if (opts.quick)
+            {
+                sizes.resize(1);
+            }
+
+            for (size_t size : sizes)
+            {
+                timed work = std::get<2>(c)(size);
+
+                double serial_time = 0;
+
+                for (int threads : opts.threads)
+                {
+                    result r = measure(name, size, threads, work);
+
+                    // speedup is relative to the first thread count in the sweep,
+                    // scaled as if that run had been perfectly parallel
+                    if (threads == opts.threads.front())
+                    {
+                        serial_time = r.mean * threads;
+                    }
+
+                    r.speedup = serial_time / r.mean;
+                    r.efficiency = r.speedup / threads;
+
+                    std::printf("%-24s %10zu %7d %12.6f %10.6f %14.4g %8.2f %6.2f\n",
+                                name.c_str(), size, threads, r.mean, r.ci95,
+                                r.throughput, r.speedup, r.efficiency);
+                    std::fflush(stdout);
+
+                    results.push_back(r);
+                }
+            }
+        }
+
+        if (!opts.json.empty())
+        {
+            write_json(opts.json);
+        }
+
+        if (!opts.baseline.empty())
+        {
+            return compare(opts.baseline);
+        }
+
+        return 0;
+    }
+
+private:
+    /** Time 'work' with 'threads' threads, after one untimed warm-up run */
+    result measure(const std::string &name, size_t size, int threads, const timed &work)
+    {
+        tbb::global_control control(tbb::global_control::max_allowed_parallelism, threads);
+
+#ifdef _OPENMP
+        omp_set_num_threads(threads);
+#endif
+
+        work.func();
+
+        std::vector<double> times;
+
+        for (int i=0; i<opts.reps; ++i)
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            work.func();
+            auto t1 = std::chrono::steady_clock::now();
+
+            times.push_back(std::chrono::duration<double>(t1 - t0).count());
+        }
+
+        double mean = 0;
+
+        for (double t : times)
+        {
+            mean += t;
+        }
+
+        mean /= times.size();
+
+        double var = 0;
+
+        for (double t : times)
+        {
+            var += (t - mean) * (t - mean);
+        }
+
+        var /= (times.size() - 1);
+
+        result r;
+        r.name = name;
+        r.size = size;
+        r.threads = threads;
+        r.mean = mean;
+        r.ci95 = detail::t95(static_cast<int>(times.size()) - 1) * std::sqrt(var / times.size());
+        r.min = *std::min_element(times.begin(), times.end());
+        r.throughput = work.elements / mean;
+
+        return r;
+    }
+
+    /** Write the results as JSON, one result per line */
+    void write_json(const std::string &filename) const
+    {
+        std::ofstream file(filename);
+
+        file << "{\"results\": [" << std::endl;
+
+        for (size_t i=0; i<results.size(); ++i)
+        {
+            const result &r = results[i];
+
+            char line[512];
+            std::snprintf(line, sizeof(line),
+                          "{\"name\":\"%s\",\"size\":%zu,\"threads\":%d,\"mean\":%.9g,"
+                          "\"ci95\":%.9g,\"min\":%.9g,\"throughput\":%.9g,\"speedup\":%.6g,"
+                          "\"efficiency\":%.6g}%s",
+                          r.name.c_str(), r.size, r.threads, r.mean, r.ci95, r.min,
+                          r.throughput, r.speedup, r.efficiency,
+                          (i+1 < results.size()) ? "," : "");
+
+            file << line << std::endl;
+        }
+
+        file << "]}" << std::endl;
+
+        std::cout << "Results written to " << filename << std::endl;
+    }
+
+    /** Compare against a baseline JSON file. A regression is a slow-down of
+        more than the threshold that is also larger than the two confidence
+        intervals combined, so noisy timings are not flagged. Returns the
+        number of regressions, or -1 if the baseline can't be read */
+    int compare(const std::string &filename) const
+    {
+        std::ifstream file(filename);
+
+        if (!file)
+        {
+            std::cerr << "Could not read baseline " << filename << std::endl;
+            return -1;
+        }
+
+        std::map<std::string, std::pair<double,double>> baseline;
+
+        std::string line;
+
+        while (std::getline(file, line))
+        {
+            std::string name = detail::json_field(line, "name");
+
+            if (name.empty())
+            {
+                continue;
+            }
+
+            size_t size = std::strtoull(detail::json_field(line, "size").c_str(), nullptr, 10);
+            int threads = std::atoi(detail::json_field(line, "threads").c_str());
+
+            baseline[detail::key(name, size, threads)] =
+                    std::make_pair(std::atof(detail::json_field(line, "mean").c_str()),
+                                   std::atof(detail::json_field(line, "ci95").c_str()));
+        }
+
+        if (baseline.empty())
+        {
+            std::cerr << "No results found in baseline " << filename << std::endl;
+            return -1;
+        }
+
+        int nregressions = 0;
+        int ncompared = 0;
+
+        for (const result &r : results)
+        {
+            auto it = baseline.find(detail::key(r.name, r.size, r.threads));
+
+            if (it == baseline.end())
+            {
+                continue;
+            }
+
+            ++ncompared;
+
+            const double base = it->second.first;
+            const double change = r.mean / base - 1.0;
+
+            if (change > opts.threshold && (r.mean - base) > (r.ci95 + it->second.second))
+            {
+                std::printf("REGRESSION %-24s size %zu threads %d: %.6f s -> %.6f s (%+.1f%%)\n",
+                            r.name.c_str(), r.size, r.threads, base, r.mean, 100.0 * change);
+                ++nregressions;
+            }
+        }
+
+        std::printf("Compared %d results against %s: %d regression(s) above %.1f%%\n",
+                    ncompared, filename.c_str(), nregressions, 100.0 * opts.threshold);
+
+        return nregressions;
+    }
+
+    options opts;
+    std::vector<std::tuple<std::string, std::vector<size_t>, setup_func>> cases;
+    std::vector<result> results;
+};
+
+} // end of namespace bench
+
+#endif
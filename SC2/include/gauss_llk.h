@@ -0,0 +1,142 @@
+#ifndef gauss_llk_h
+#define gauss_llk_h
+
+/*  Gaussian and log-normal log-likelihoods of whole series.
+
+        double gl_normal(const double *x, const double *mu, size_t n, double sig);
+        double gl_lognormal(const double *yobs, const double *ysim, size_t n, double sig);
+        void gl_lognormal_cols(const double *yobs, const double *ysim, size_t n,
+                               size_t ld, size_t m, double sig, double *out);
+
+    gl_normal is the sum over i of log N(x[i]; mu[i], sig^2), and
+    gl_lognormal the sum of log N(log(yobs[i] / ysim[i]); 0, sig^2), the
+    log-likelihood of multiplicative log-normal noise used by rickerLLK.
+    They give the same values as summing Rmath's dnorm(..., 1), but the
+    normalising constant and 1/sig^2 are applied once to the sum of squares
+    rather than to every term, the logs are done a block at a time by
+    sm_log, and the squares go to four partial sums so the additions don't
+    wait on each other.
+
+    gl_lognormal_cols does m series at once: series j starts at
+    ysim + j * ld (the columns of a column-major matrix, as R stores them)
+    and its log-likelihood goes to out[j]. The logs of yobs are computed once
+    per block of rows and shared by all the series.
+
+    Like simd_math.h, this header can be included from C as well as C++.
+*/
+
+#include <math.h>
+#include <stddef.h>
+
+#include "simd_math.h"
+
+#define GL_BLOCK 256
+
+/* log(sqrt(2 * pi)) */
+#define GL_LN_SQRT_2PI 0.918938533204672741780329736406
+
+/* sum of d[i]^2 for i in [0,n), in four partial sums */
+static inline double gl_sumsq(const double *d, size_t n)
+{
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+        s0 += d[i] * d[i];
+        s1 += d[i + 1] * d[i + 1];
+        s2 += d[i + 2] * d[i + 2];
+        s3 += d[i + 3] * d[i + 3];
+    }
+    for (; i < n; i++)
+    {
+        s0 += d[i] * d[i];
+    }
+
+    return (s0 + s1) + (s2 + s3);
+}
+
+/* the log-likelihood of n terms with sd sig whose squared deviations sum to ss */
+static inline double gl_from_sumsq(double ss, size_t n, double sig)
+{
+    return -0.5 * ss / (sig * sig) - (double)n * (log(sig) + GL_LN_SQRT_2PI);
+}
+
+static inline double gl_normal(const double *x, const double *mu, size_t n, double sig)
+{
+    double d[GL_BLOCK];
+    double ss = 0;
+    size_t start, i;
+
+    for (start = 0; start < n; start += GL_BLOCK)
+    {
+        size_t nb = (n - start < GL_BLOCK) ? n - start : GL_BLOCK;
+
+        for (i = 0; i < nb; i++)
+        {
+            d[i] = x[start + i] - mu[start + i];
+        }
+        ss += gl_sumsq(d, nb);
+    }
+
+    return gl_from_sumsq(ss, n, sig);
+}
+
+static inline double gl_lognormal(const double *yobs, const double *ysim, size_t n, double sig)
+{
+    double d[GL_BLOCK];
+    double ss = 0;
+    size_t start, i;
+
+    for (start = 0; start < n; start += GL_BLOCK)
+    {
+        size_t nb = (n - start < GL_BLOCK) ? n - start : GL_BLOCK;
+
+        for (i = 0; i < nb; i++)
+        {
+            d[i] = yobs[start + i] / ysim[start + i];
+        }
+        sm_log(d, d, nb);
+        ss += gl_sumsq(d, nb);
+    }
+
+    return gl_from_sumsq(ss, n, sig);
+}
+
+static inline void gl_lognormal_cols(const double *yobs, const double *ysim, size_t n,
+                                     size_t ld, size_t m, double sig, double *out)
+{
+    double logy[GL_BLOCK], d[GL_BLOCK];
+    size_t start, i, j;
+
+    for (j = 0; j < m; j++)
+    {
+        out[j] = 0;
+    }
+
+    for (start = 0; start < n; start += GL_BLOCK)
+    {
+        size_t nb = (n - start < GL_BLOCK) ? n - start : GL_BLOCK;
+
+        sm_log(yobs + start, logy, nb);
+
+        for (j = 0; j < m; j++)
+        {
+            const double *y = ysim + j * ld + start;
+
+            sm_log(y, d, nb);
+            for (i = 0; i < nb; i++)
+            {
+                d[i] = logy[i] - d[i];
+            }
+            out[j] += gl_sumsq(d, nb);
+        }
+    }
+
+    for (j = 0; j < m; j++)
+    {
+        out[j] = gl_from_sumsq(out[j], n, sig);
+    }
+}
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef numa_alloc_h
+#define numa_alloc_h
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/partitioner.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+#include <tbb/info.h>
+
+/*  NUMA-aware storage for large arrays that are filled and then reduced in
+    parallel.
+
+    Linux places a page on the NUMA node of the thread that first writes to
+    it. A std::vector<double>(n) zero-fills every page on the constructing
+    thread, so a later tbb::parallel_reduce reads most of them from a remote
+    node. Instead:
+
+        auto values = numa::vector<double>(n);          // pages not touched yet
+        auto layout = numa::layout(values.size(), sizeof(double));
+
+        numa::first_touch(layout, values, [](size_t i){ return std::sin(i * 0.001); });
+
+        auto total = layout.parallel_reduce(0.0, [&](tbb::blocked_range<size_t> r, double t)
+                                                 { ...; return t; }, std::plus<double>());
+
+    The layout gives every node a contiguous, page-aligned slice, a task_arena
+    bound to that node and its own tbb::affinity_partitioner. Every pass run
+    through the same layout hands the same sub-ranges to the same threads, so
+    each page is reduced where it was written.
+
+    On a single-node machine (or when TBB was built without hwloc support)
+    there is one slice running in the default arena. Setting the environment
+    variable NUMA_EMULATE_NODES=<n> splits the work into n unbound slices so
+    the multi-node code path can be exercised on any machine.
+*/
+
+namespace numa
+{
+
+namespace detail
+{
+    /** Return the size of a memory page in bytes */
+    inline size_t page_size()
+    {
+        static const size_t sz = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return sz;
+    }
+
+    /** Round 'nbytes' up to a whole number of pages */
+    inline size_t round_to_pages(size_t nbytes)
+    {
+        const size_t pg = page_size();
+        return ((nbytes + pg - 1) / pg) * pg;
+    }
+
+    /** Return the number of emulated nodes requested via NUMA_EMULATE_NODES,
+        or 0 if emulation has not been requested */
+    inline int emulated_nodes()
+    {
+        const char *env = std::getenv("NUMA_EMULATE_NODES");
+
+        if (env == nullptr)
+        {
+            return 0;
+        }
+
+        return std::max(0, std::atoi(env));
+    }
+}
+
+/** Allocator that maps fresh pages straight from the OS and never writes
+    to them. Elements are default-initialised, so a vector of doubles built
+    with this allocator is left untouched until first_touch() fills it */
+template<class T>
+class allocator
+{
+public:
+    typedef T value_type;
+
+    allocator() noexcept
+    {}
+
+    template<class U>
+    allocator(const allocator<U>&) noexcept
+    {}
+
+    T* allocate(size_t n)
+    {
+        if (n == 0)
+        {
+            return nullptr;
+        }
+
+        void *p = mmap(nullptr, detail::round_to_pages(n * sizeof(T)),
+                       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (p == MAP_FAILED)
+        {
+            throw std::bad_alloc();
+        }
+
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T *p, size_t n) noexcept
+    {
+        if (p != nullptr)
+        {
+            munmap(p, detail::round_to_pages(n * sizeof(T)));
+        }
+    }
+
+    /** Default-initialise rather than value-initialise, so that no
+        page is written during construction */
+    template<class U>
+    void construct(U *p) noexcept(std::is_nothrow_default_constructible<U>::value)
+    {
+        ::new(static_cast<void*>(p)) U;
+    }
+
+    template<class U, class... ARGS>
+    void construct(U *p, ARGS&&... args)
+    {
+        ::new(static_cast<void*>(p)) U(std::forward<ARGS>(args)...);
+    }
+};
+
+template<class T, class U>
+bool operator==(const allocator<T>&, const allocator<U>&) { return true; }
+
+template<class T, class U>
+bool operator!=(const allocator<T>&, const allocator<U>&) { return false; }
+
+/** A std::vector whose pages are placed by first touch */
+template<class T>
+using vector = std::vector<T, allocator<T>>;
+
+/** Splits the index range [0,n) across the NUMA nodes of the machine,
+    with one task_arena and one affinity_partitioner per node */
+class layout
+{
+public:
+    /** Build a layout for 'n' elements of 'elem_size' bytes each. Slice
+        boundaries are rounded to whole pages so no page is shared by two nodes */
+    layout(size_t n, size_t elem_size=sizeof(double)) : n(n)
+    {
+        std::vector<tbb::numa_node_id> nodes = tbb::info::numa_nodes();
+
+        int nemulate = detail::emulated_nodes();
+
+        int nnodes = (nemulate > 0) ? nemulate : static_cast<int>(nodes.size());
+
+        const size_t page_elems = std::max<size_t>(1, detail::page_size() / elem_size);
+        const size_t npages = (n + page_elems - 1) / page_elems;
+
+        // never give a node less than one page of work
+        nnodes = static_cast<int>(std::max<size_t>(1, std::min<size_t>(nnodes, npages)));
+
+        bounds.push_back(0);
+
+        for (int i=1; i<nnodes; ++i)
+        {
+            bounds.push_back(std::min(n, (npages * i / nnodes) * page_elems));
+        }
+
+        bounds.push_back(n);
+
+        for (int i=0; i<nnodes; ++i)
+        {
+            if (nemulate > 0)
+            {
+                // emulated nodes share the machine equally, without binding
+                int threads = std::max(1, tbb::this_task_arena::max_concurrency() / nnodes);
+                arenas.emplace_back(new tbb::task_arena(threads));
+            }
+            else if (nnodes > 1)
+            {
+                arenas.emplace_back(new tbb::task_arena(tbb::task_arena::constraints(nodes[i])));
+            }
+            else
+            {
+                arenas.emplace_back(new tbb::task_arena());
+            }
+
+            partitioners.emplace_back(new tbb::affinity_partitioner());
+        }
+    }
+
+    /** Return the number of (real or emulated) nodes in this layout */
+    int nnodes() const
+    {
+        return static_cast<int>(arenas.size());
+    }
+
+    /** Return the number of elements covered by this layout */
+    size_t size() const
+    {
+        return n;
+    }
+
+    /** Return the range of indices owned by node 'i' */
+    tbb::blocked_range<size_t> slice(int i) const
+    {
+        return tbb::blocked_range<size_t>(bounds[i], bounds[i+1]);
+    }
+
+    /** Call 'func(tbb::blocked_range<size_t>)' over the whole range, with
+        each node's slice run by the threads of that node */
+    template<class FUNC>
+    void parallel_for(FUNC func)
+    {
+        on_each_node([&](int i)
+        {
+            tbb::parallel_for(slice(i), func, *(partitioners[i]));
+        });
+    }
+
+    /** Reduce over the whole range, with each node reducing its own slice
+        using 'func(tbb::blocked_range<size_t>, T running_total)' and the
+        per-node results then combined with 'redfunc' */
+    template<class T, class FUNC, class REDFUNC>
+    T parallel_reduce(const T &identity, FUNC func, REDFUNC redfunc)
+    {
+        std::vector<T> partial(nnodes(), identity);
+
+        on_each_node([&](int i)
+        {
+            partial[i] = tbb::parallel_reduce(slice(i), identity, func, redfunc,
+                                              *(partitioners[i]));
+        });
+
+        T result = identity;
+
+        for (const T &value : partial)
+        {
+            result = redfunc(result, value);
+        }
+
+        return result;
+    }
+
+private:
+    /** Run 'func(i)' inside the arena of every node 'i' concurrently,
+        returning once all nodes have finished */
+    template<class FUNC>
+    void on_each_node(FUNC func)
+    {
+        if (nnodes() == 1)
+        {
+            arenas[0]->execute([&](){ func(0); });
+            return;
+        }
+
+        std::vector<tbb::task_group> groups(nnodes());
+
+        for (int i=0; i<nnodes(); ++i)
+        {
+            arenas[i]->execute([&, i](){ groups[i].run([&, i](){ func(i); }); });
+        }
+
+        for (int i=0; i<nnodes(); ++i)
+        {
+            arenas[i]->execute([&, i](){ groups[i].wait(); });
+        }
+    }
+
+    size_t n;
+    std::vector<size_t> bounds;
+    std::vector<std::unique_ptr<tbb::task_arena>> arenas;
+    std::vector<std::unique_ptr<tbb::affinity_partitioner>> partitioners;
+};
+
+/** Fill 'values[i] = func(i)' in parallel, so that each page is first
+    touched by the node (and thread) that 'l' will later use to process it */
+template<class T, class FUNC>
+void first_touch(layout &l, vector<T> &values, FUNC func)
+{
+    T *data = values.data();
+
+    l.parallel_for([=](tbb::blocked_range<size_t> r)
+    {
+        for (size_t i=r.begin(); i<r.end(); ++i)
+        {
+            data[i] = func(i);
+        }
+    });
+}
+
+} // end of namespace numa
+
+#endif
@@ -0,0 +1,394 @@
+#ifndef perfcounters_h
+#define perfcounters_h
+
+/*  Hardware performance counters around a region of code, using Linux
+    perf_event_open. For example
+
+        {
+            perf::region region("energy", group_a.size() * group_b.size());
+            energy = calculate_energy(group_a, group_b);
+        }
+
+    prints, when the region ends, the wall time and for each thread that did
+    work (and in total) the cycles, instructions, IPC, cache misses, branch
+    misses and stalled cycles, with the misses also given per element. High
+    IPC with few cache misses per element points to a compute-bound kernel,
+    low IPC with many misses (or stalls) to a memory-bound one.
+
+    Every thread gets its own set of counters. The calling thread is
+    registered automatically, as are TBB worker threads (through a
+    tbb::task_scheduler_observer). Threads from anything else, e.g. an
+    OpenMP team, should call perf::register_thread() once when they start;
+    define PERF_NO_TBB to use this header without TBB.
+
+    Hardware counters need perf_event_paranoid <= 2 and a CPU/VM that
+    exposes a PMU. When they can't be opened the region reports the
+    software counters (task clock, page faults, context switches and CPU
+    migrations) instead, and if perf_event_open is not available at all
+    only the wall time is shown. Counts are scaled if the kernel had to
+    multiplex the counters.
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifndef PERF_NO_TBB
+#include <tbb/task_scheduler_observer.h>
+#endif
+
+namespace perf
+{
+
+/** The counters recorded for each thread */
+enum counter
+{
+    CYCLES = 0,
+    INSTRUCTIONS,
+    CACHE_MISSES,
+    BRANCH_MISSES,
+    STALLED_CYCLES,
+    TASK_CLOCK,
+    PAGE_FAULTS,
+    CONTEXT_SWITCHES,
+    CPU_MIGRATIONS,
+    NCOUNTERS
+};
+
+namespace detail
+{
+    struct counter_def
+    {
+        uint32_t type;
+        uint64_t config;
+        const char *name;
+    };
+
+#ifdef __linux__
+    inline const counter_def& get_def(int i)
+    {
+        static const counter_def defs[NCOUNTERS] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses" },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND, "stalled-cycles" },
+            { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock" },
+            { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults" },
+            { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches" },
+            { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "cpu-migrations" }
+        };
+
+        return defs[i];
+    }
+
+    /** Open counter 'i' for the calling thread, returning -1 on failure */
+    inline int open_counter(int i)
+    {
+        struct perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+
+        attr.size = sizeof(attr);
+        attr.type = get_def(i).type;
+        attr.config = get_def(i).config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+
+        // not every CPU counts backend stalls, so fall back to frontend stalls
+        if (fd < 0 && i == STALLED_CYCLES)
+        {
+            attr.config = PERF_COUNT_HW_STALLED_CYCLES_FRONTEND;
+            fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+
+        return fd;
+    }
+#endif
+
+    /** Counter values for one thread; a negative value means "not available" */
+    struct values
+    {
+        values()
+        {
+            for (int i=0; i<NCOUNTERS; ++i)
+            {
+                v[i] = -1;
+            }
+        }
+
+        double v[NCOUNTERS];
+    };
+
+    /** The counters belonging to one thread. They can be read from any thread */
+    class thread_counters
+    {
+    public:
+        thread_counters(int tid) : tid(tid)
+        {
+            for (int i=0; i<NCOUNTERS; ++i)
+            {
+#ifdef __linux__
+                fds[i] = open_counter(i);
+#else
+                fds[i] = -1;
+#endif
+            }
+        }
+
+        ~thread_counters()
+        {
+#ifdef __linux__
+            for (int i=0; i<NCOUNTERS; ++i)
+            {
+                if (fds[i] >= 0)
+                {
+                    close(fds[i]);
+                }
+            }
+#endif
+        }
+
+        values read() const
+        {
+            values result;
+
+#ifdef __linux__
+            for (int i=0; i<NCOUNTERS; ++i)
+            {
+                uint64_t buf[3];
+
+                if (fds[i] >= 0 && ::read(fds[i], buf, sizeof(buf)) == sizeof(buf))
+                {
+                    // scale up if the kernel multiplexed this counter
+                    result.v[i] = (buf[2] > 0) ? double(buf[0]) * double(buf[1]) / double(buf[2])
+                                               : 0.0;
+                }
+            }
+#endif
+
+            return result;
+        }
+
+        bool has(int i) const
+        {
+            return fds[i] >= 0;
+        }
+
+        int tid;
+
+    private:
+        int fds[NCOUNTERS];
+    };
+
+    /** Holds the counters of every registered thread */
+    class registry
+    {
+    public:
+        thread_counters* add_thread()
+        {
+            std::lock_guard<std::mutex> lock(m);
+            threads.emplace_back(new thread_counters(static_cast<int>(threads.size())));
+            return threads.back().get();
+        }
+
+        /** Read the counters of every registered thread */
+        std::vector<values> read_all()
+        {
+            std::lock_guard<std::mutex> lock(m);
+
+            std::vector<values> result;
+
+            for (const auto &t : threads)
+            {
+                result.push_back(t->read());
+            }
+
+            return result;
+        }
+
+        /** Return whether counter 'i' could be opened on the first thread */
+        bool has(int i)
+        {
+            std::lock_guard<std::mutex> lock(m);
+            return (!threads.empty()) && threads[0]->has(i);
+        }
+
+    private:
+        std::mutex m;
+        std::vector<std::unique_ptr<thread_counters>> threads;
+    };
+
+    inline registry& get_registry()
+    {
+        static registry r;
+        return r;
+    }
+
+#ifndef PERF_NO_TBB
+    /** Registers each TBB worker thread as it joins the arena */
+    class tbb_observer : public tbb::task_scheduler_observer
+    {
+    public:
+        tbb_observer()
+        {
+            observe(true);
+        }
+
+        ~tbb_observer()
+        {
+            observe(false);
+        }
+
+        void on_scheduler_entry(bool is_worker) override;
+    };
+#endif
+}
+
+/** Open counters for the calling thread (only the first call does anything) */
+inline void register_thread()
+{
+    static thread_local detail::thread_counters *counters = detail::get_registry().add_thread();
+    (void)counters;
+}
+
+#ifndef PERF_NO_TBB
+inline void detail::tbb_observer::on_scheduler_entry(bool)
+{
+    register_thread();
+}
+#endif
+
+/** Measures the counters of every thread between construction and
+    destruction, printing a report labelled 'name' at the end. 'nelements'
+    is the number of elements processed, used for the per-element figures */
+class region
+{
+public:
+    region(const std::string &name, double nelements=0) : name(name), nelements(nelements)
+    {
+        register_thread();
+
+#ifndef PERF_NO_TBB
+        static detail::tbb_observer observer;
+#endif
+
+        t0 = std::chrono::steady_clock::now();
+        start = detail::get_registry().read_all();
+    }
+
+    ~region()
+    {
+        auto finish = detail::get_registry().read_all();
+        auto t1 = std::chrono::steady_clock::now();
+
+        report(finish, std::chrono::duration<double>(t1 - t0).count());
+    }
+
+private:
+    void report(const std::vector<detail::values> &finish, double seconds) const
+    {
+        auto &reg = detail::get_registry();
+
+        const bool hardware = reg.has(CYCLES) && reg.has(INSTRUCTIONS);
+        const bool software = reg.has(TASK_CLOCK);
+
+        std::printf("== %s: %.6f seconds\n", name.c_str(), seconds);
+
+        if (!software)
+        {
+            std::printf("   (performance counters unavailable)\n");
+            return;
+        }
+
+        if (!hardware)
+        {
+            std::printf("   (hardware counters unavailable, showing software counters)\n");
+        }
+
+        detail::values total;
+
+        for (int i=0; i<NCOUNTERS; ++i)
+        {
+            total.v[i] = 0;
+        }
+
+        for (size_t t=0; t<finish.size(); ++t)
+        {
+            detail::values delta;
+
+            for (int i=0; i<NCOUNTERS; ++i)
+            {
+                if (finish[t].v[i] >= 0)
+                {
+                    // threads registered during the region started from zero
+                    double before = (t < start.size() && start[t].v[i] >= 0) ? start[t].v[i] : 0;
+                    delta.v[i] = finish[t].v[i] - before;
+                    total.v[i] += delta.v[i];
+                }
+            }
+
+            // skip threads that did no work in this region
+            if (delta.v[TASK_CLOCK] > 0)
+            {
+                char label[32];
+                std::snprintf(label, sizeof(label), "thread %d", static_cast<int>(t));
+                print_line(label, delta, hardware);
+            }
+        }
+
+        print_line("total", total, hardware);
+    }
+
+    void print_line(const char *label, const detail::values &d, bool hardware) const
+    {
+        std::printf("   %-10s task-clock %10.3f ms", label, d.v[TASK_CLOCK] * 1e-6);
+
+        if (hardware)
+        {
+            std::printf("  cycles %12.0f  instr %12.0f  IPC %5.2f",
+                        d.v[CYCLES], d.v[INSTRUCTIONS],
+                        d.v[CYCLES] > 0 ? d.v[INSTRUCTIONS] / d.v[CYCLES] : 0.0);
+
+            if (d.v[STALLED_CYCLES] >= 0 && d.v[CYCLES] > 0)
+            {
+                std::printf("  stalled %5.1f%%", 100.0 * d.v[STALLED_CYCLES] / d.v[CYCLES]);
+            }
+
+            if (nelements > 0)
+            {
+                std::printf("  cache-miss/elem %.4f  branch-miss/elem %.4f",
+                            d.v[CACHE_MISSES] / nelements, d.v[BRANCH_MISSES] / nelements);
+            }
+        }
+        else
+        {
+            std::printf("  page-faults %8.0f  ctx-switches %6.0f  migrations %4.0f",
+                        d.v[PAGE_FAULTS], d.v[CONTEXT_SWITCHES], d.v[CPU_MIGRATIONS]);
+        }
+
+        std::printf("\n");
+    }
+
+    std::string name;
+    double nelements;
+    std::chrono::steady_clock::time_point t0;
+    std::vector<detail::values> start;
+};
+
+} // end of namespace perf
+
+#endif
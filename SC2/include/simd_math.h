@@ -0,0 +1,159 @@
+#ifndef simd_math_h
+#define simd_math_h
+
+/*  Vectorised sin, exp and log over arrays of doubles.
+
+        void sm_sin(const double *x, double *y, size_t n);
+        void sm_exp(const double *x, double *y, size_t n);
+        void sm_log(const double *x, double *y, size_t n);
+
+    'x' and 'y' may be the same array. Scalar versions sm_sin1, sm_exp1 and
+    sm_log1 evaluate one argument with the generic kernels, giving the same
+    results as the array versions. They are slower than libm for a single
+    value, so serial code that doesn't need to match the array versions
+    should call sin, exp and log instead.
+
+    The kernels are compiled three times: for AVX-512, for AVX2+FMA and for
+    the generic 2-wide vectors GCC/Clang lower to SSE2, NEON or plain scalar
+    code. The widest version the CPU supports is picked at run time, so no
+    -march flag is needed. Defining SM_NO_DISPATCH before including this
+    header always uses the generic version (bit-for-bit identical results on
+    every machine). Other compilers fall back to libm.
+
+    Accuracy, measured against glibc over 4*10^6 uniform random arguments
+    per range and instruction set:
+
+        sm_exp   |x| <= 708                  max error 1 ulp
+        sm_log   x normal, finite, > 0       max error 1 ulp
+        sm_sin   |x| <= 100                  max error 1 ulp
+                 100 < |x| <= 1e5            max error 2 ulp
+
+    Arguments outside these ranges (including NaN, infinities, zeros and
+    subnormals for log, and underflow/overflow for exp) are passed to libm
+    for the whole vector they appear in, so edge cases behave exactly like
+    the standard library.
+
+    This header can be included from C (e.g. .Call code built with
+    R CMD SHLIB) as well as C++.
+*/
+
+#include <math.h>
+#include <float.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__)
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(SM_NO_DISPATCH)
+#define SM_X86_DISPATCH 1
+#endif
+
+#define SM_SUFFIX generic
+#define SM_W 2
+#define SM_TARGET
+#include "simd_math_kernels.h"
+
+#ifdef SM_X86_DISPATCH
+
+#define SM_SUFFIX avx2
+#define SM_W 4
+#define SM_TARGET __attribute__((target("avx2,fma")))
+#include "simd_math_kernels.h"
+
+#define SM_SUFFIX avx512
+#define SM_W 8
+#define SM_TARGET __attribute__((target("avx512f")))
+#include "simd_math_kernels.h"
+
+/* Return 2 for AVX-512, 1 for AVX2+FMA and 0 otherwise */
+static inline int sm_cpu_level(void)
+{
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return 2;
+    }
+    else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+#define SM_DISPATCH(name, x, y, n)                                    \
+    switch (sm_cpu_level())                                           \
+    {                                                                 \
+        case 2: name##_avx512(x, y, n); break;                        \
+        case 1: name##_avx2(x, y, n); break;                          \
+        default: name##_generic(x, y, n);                             \
+    }
+
+#else
+
+#define SM_DISPATCH(name, x, y, n) name##_generic(x, y, n);
+
+#endif
+
+/* y[i] = sin(x[i]) for i in [0,n) */
+static inline void sm_sin(const double *x, double *y, size_t n)
+{
+    SM_DISPATCH(sm_sin_array, x, y, n)
+}
+
+/* y[i] = exp(x[i]) for i in [0,n) */
+static inline void sm_exp(const double *x, double *y, size_t n)
+{
+    SM_DISPATCH(sm_exp_array, x, y, n)
+}
+
+/* y[i] = log(x[i]) for i in [0,n) */
+static inline void sm_log(const double *x, double *y, size_t n)
+{
+    SM_DISPATCH(sm_log_array, x, y, n)
+}
+
+static inline double sm_sin1(double x)
+{
+    return sm_sin_scalar_generic(x);
+}
+
+static inline double sm_exp1(double x)
+{
+    return sm_exp_scalar_generic(x);
+}
+
+static inline double sm_log1(double x)
+{
+    return sm_log_scalar_generic(x);
+}
+
+#undef SM_DISPATCH
+
+#else /* not GCC or Clang: plain libm loops */
+
+static inline void sm_sin(const double *x, double *y, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) y[i] = sin(x[i]);
+}
+
+static inline void sm_exp(const double *x, double *y, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) y[i] = exp(x[i]);
+}
+
+static inline void sm_log(const double *x, double *y, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) y[i] = log(x[i]);
+}
+
+static inline double sm_sin1(double x) { return sin(x); }
+static inline double sm_exp1(double x) { return exp(x); }
+static inline double sm_log1(double x) { return log(x); }
+
+#endif
+
+#endif
@@ -0,0 +1,244 @@
+/*  Kernels for simd_math.h. This file is included once per instruction set,
+    with SM_SUFFIX (name suffix), SM_W (doubles per vector) and SM_TARGET
+    (function target attribute) defined, so it has no include guard. It
+    should not be included directly.
+
+    The polynomials are the fdlibm minimax approximations (as used by glibc's
+    and FreeBSD's libm), evaluated on a whole vector at once. Masks and lane
+    selection use bitwise operations so the code is valid C as well as C++.
+*/
+
+#define SM_CAT2(a, b) a##_##b
+#define SM_CAT(a, b) SM_CAT2(a, b)
+#define SM_FN(name) SM_CAT(name, SM_SUFFIX)
+
+typedef double SM_FN(sm_vd) __attribute__((vector_size(8 * SM_W)));
+typedef int64_t SM_FN(sm_vi) __attribute__((vector_size(8 * SM_W)));
+
+#define SM_VD SM_FN(sm_vd)
+#define SM_VI SM_FN(sm_vi)
+
+/* 1.5 * 2^52: adding this rounds a double to the nearest integer, which is
+   then held in the low bits of the result */
+#define SM_ROUND_MAGIC 6755399441055744.0
+#define SM_ROUND_MAGIC_BITS 0x4338000000000000LL
+
+/* Return the absolute value of each lane */
+static inline SM_TARGET SM_VD SM_FN(sm_fabs_v)(SM_VD x)
+{
+    return (SM_VD)((SM_VI)x & 0x7fffffffffffffffLL);
+}
+
+/* Return 1 if every lane of the comparison mask 'ok' is set */
+static inline SM_TARGET int SM_FN(sm_all_v)(SM_VI ok)
+{
+    int i;
+    int64_t all = -1;
+
+    for (i = 0; i < SM_W; i++)
+    {
+        all &= ok[i];
+    }
+
+    return all != 0;
+}
+
+/* exp(x) for |x| <= 708: x = k*ln2 + r with |r| <= ln2/2, then
+   exp(x) = 2^k * exp(r), with exp(r) from its Taylor series to r^13 */
+static inline SM_TARGET SM_VD SM_FN(sm_exp_v)(SM_VD x)
+{
+    const double log2e = 1.44269504088896338700e+00;
+    const double ln2_hi = 6.93147180369123816490e-01;
+    const double ln2_lo = 1.90821492927058770002e-10;
+
+    SM_VD t = x * log2e + SM_ROUND_MAGIC;
+    SM_VD kd = t - SM_ROUND_MAGIC;
+    SM_VI ki = (SM_VI)t - SM_ROUND_MAGIC_BITS;
+
+    SM_VD r = x - kd * ln2_hi;
+    r = r - kd * ln2_lo;
+
+    SM_VD p = r * (1.0 / 6227020800.0) + (1.0 / 479001600.0);
+    p = p * r + (1.0 / 39916800.0);
+    p = p * r + (1.0 / 3628800.0);
+    p = p * r + (1.0 / 362880.0);
+    p = p * r + (1.0 / 40320.0);
+    p = p * r + (1.0 / 5040.0);
+    p = p * r + (1.0 / 720.0);
+    p = p * r + (1.0 / 120.0);
+    p = p * r + (1.0 / 24.0);
+    p = p * r + (1.0 / 6.0);
+    p = p * r + 0.5;
+
+    SM_VD er = 1.0 + (r + (r * r) * p);
+
+    SM_VD scale = (SM_VD)((ki + 1023) << 52);
+
+    return er * scale;
+}
+
+/* log(x) for normal, finite, positive x: x = 2^k * m with m in
+   [sqrt(2)/2, sqrt(2)), then log(m) = f - s*(f - R(s^2)) with f = m - 1
+   and s = f/(2+f), as in fdlibm's e_log.c */
+static inline SM_TARGET SM_VD SM_FN(sm_log_v)(SM_VD x)
+{
+    const double ln2_hi = 6.93147180369123816490e-01;
+    const double ln2_lo = 1.90821492927058770002e-10;
+    const double Lg1 = 6.666666666666735130e-01;
+    const double Lg2 = 3.999999999940941908e-01;
+    const double Lg3 = 2.857142874366239149e-01;
+    const double Lg4 = 2.222219843214978396e-01;
+    const double Lg5 = 1.818357216161805012e-01;
+    const double Lg6 = 1.531383769920937332e-01;
+    const double Lg7 = 1.479819860511658591e-01;
+
+    SM_VI bits = (SM_VI)x;
+    SM_VI k = ((bits >> 52) & 0x7ff) - 1023;
+    SM_VD m = (SM_VD)((bits & 0x000fffffffffffffLL) | 0x3ff0000000000000LL);
+
+    /* halve m (and increment k) where m > sqrt(2) */
+    SM_VI big = (m > 1.41421356237309504880);
+    m = (SM_VD)(((SM_VI)m & ~big) | ((SM_VI)(m * 0.5) & big));
+    k = k - big;
+
+    SM_VD dk = (SM_VD)(k + SM_ROUND_MAGIC_BITS) - SM_ROUND_MAGIC;
+
+    SM_VD f = m - 1.0;
+    SM_VD s = f / (2.0 + f);
+    SM_VD z = s * s;
+    SM_VD w = z * z;
+
+    SM_VD t1 = w * (Lg2 + w * (Lg4 + w * Lg6));
+    SM_VD t2 = z * (Lg1 + w * (Lg3 + w * (Lg5 + w * Lg7)));
+    SM_VD R = t2 + t1;
+    SM_VD hfsq = 0.5 * f * f;
+
+    return dk * ln2_hi - ((hfsq - (s * (hfsq + R) + dk * ln2_lo)) - f);
+}
+
+/* sin(x) for |x| <= 1e5: x = k*pi/2 + r with |r| <= pi/4, using a
+   three-part Cody-Waite split of pi/2, then sin or cos of r depending on
+   the quadrant k mod 4 (fdlibm's k_sin.c and k_cos.c polynomials) */
+static inline SM_TARGET SM_VD SM_FN(sm_sin_v)(SM_VD x)
+{
+    const double two_over_pi = 6.36619772367581382433e-01;
+    const double pio2_1 = 1.57079632673412561417e+00;
+    const double pio2_2 = 6.07710050630396597660e-11;
+    const double pio2_3 = 2.02226624871116645580e-21;
+    const double S1 = -1.66666666666666324348e-01;
+    const double S2 = 8.33333333332248946124e-03;
+    const double S3 = -1.98412698298579493134e-04;
+    const double S4 = 2.75573137070700676789e-06;
+    const double S5 = -2.50507602534068634195e-08;
+    const double S6 = 1.58969099521155010221e-10;
+    const double C1 = 4.16666666666666019037e-02;
+    const double C2 = -1.38888888888741095749e-03;
+    const double C3 = 2.48015872894767294178e-05;
+    const double C4 = -2.75573143513906633035e-07;
+    const double C5 = 2.08757232129817482790e-09;
+    const double C6 = -1.13596475577881948265e-11;
+
+    SM_VD t = x * two_over_pi + SM_ROUND_MAGIC;
+    SM_VD kd = t - SM_ROUND_MAGIC;
+    SM_VI q = (SM_VI)t;
+
+    SM_VD r = x - kd * pio2_1;
+    r = r - kd * pio2_2;
+    r = r - kd * pio2_3;
+
+    SM_VD z = r * r;
+
+    SM_VD sp = S2 + z * (S3 + z * (S4 + z * (S5 + z * S6)));
+    SM_VD sinr = r + (z * r) * (S1 + z * sp);
+
+    SM_VD hz = 0.5 * z;
+    SM_VD w = 1.0 - hz;
+    SM_VD cp = z * (C1 + z * (C2 + z * (C3 + z * (C4 + z * (C5 + z * C6)))));
+    SM_VD cosr = w + (((1.0 - w) - hz) + z * cp);
+
+    /* odd quadrants use cos(r), quadrants 2 and 3 flip the sign */
+    SM_VI odd = -(q & 1);
+    SM_VI sign = (q & 2) << 62;
+
+    SM_VI res = ((SM_VI)sinr & ~odd) | ((SM_VI)cosr & odd);
+    res = res ^ sign;
+
+    /* sin(x) rounds to x for |x| < 2^-26, which also keeps the sign of -0 */
+    SM_VI tiny = (SM_FN(sm_fabs_v)(x) < 1.4901161193847656e-08);
+
+    return (SM_VD)((res & ~tiny) | ((SM_VI)x & tiny));
+}
+
+/* Define the block, scalar and array functions for one kernel. Each block of
+   SM_W values goes through the vector kernel if every lane is in range, or
+   through libm otherwise. The tail is padded with 'pad' so it uses the same
+   kernel as the rest of the array */
+#define SM_DEFINE_ARRAY(name, libm, in_range, pad)                             \
+static inline SM_TARGET void SM_FN(name##_block)(const double *x, double *y)  \
+{                                                                              \
+    SM_VD v;                                                                   \
+    int i;                                                                     \
+    memcpy(&v, x, sizeof(v));                                                  \
+    if (SM_FN(sm_all_v)(in_range))                                             \
+    {                                                                          \
+        v = SM_FN(name##_v)(v);                                                \
+        memcpy(y, &v, sizeof(v));                                              \
+    }                                                                          \
+    else                                                                       \
+    {                                                                          \
+        for (i = 0; i < SM_W; i++)                                             \
+        {                                                                      \
+            y[i] = libm(x[i]);                                                 \
+        }                                                                      \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+static SM_TARGET void SM_FN(name##_array)(const double *x, double *y, size_t n)\
+{                                                                              \
+    size_t i, j;                                                               \
+    double buf[SM_W];                                                          \
+    for (i = 0; i + SM_W <= n; i += SM_W)                                      \
+    {                                                                          \
+        SM_FN(name##_block)(x + i, y + i);                                     \
+    }                                                                          \
+    if (i < n)                                                                 \
+    {                                                                          \
+        for (j = 0; j < SM_W; j++)                                             \
+        {                                                                      \
+            buf[j] = (i + j < n) ? x[i + j] : pad;                             \
+        }                                                                      \
+        SM_FN(name##_block)(buf, buf);                                         \
+        for (j = 0; i + j < n; j++)                                            \
+        {                                                                      \
+            y[i + j] = buf[j];                                                 \
+        }                                                                      \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+static inline SM_TARGET double SM_FN(name##_scalar)(double x)                  \
+{                                                                              \
+    double buf[SM_W];                                                          \
+    int j;                                                                     \
+    for (j = 0; j < SM_W; j++)                                                 \
+    {                                                                          \
+        buf[j] = x;                                                            \
+    }                                                                          \
+    SM_FN(name##_block)(buf, buf);                                             \
+    return buf[0];                                                             \
+}
+
+SM_DEFINE_ARRAY(sm_exp, exp, (SM_FN(sm_fabs_v)(v) <= 708.0), 0.0)
+SM_DEFINE_ARRAY(sm_log, log, ((v >= DBL_MIN) & (v <= DBL_MAX)), 1.0)
+SM_DEFINE_ARRAY(sm_sin, sin, (SM_FN(sm_fabs_v)(v) <= 1.0e5), 0.0)
+
+#undef SM_DEFINE_ARRAY
+#undef SM_ROUND_MAGIC
+#undef SM_ROUND_MAGIC_BITS
+#undef SM_VD
+#undef SM_VI
+#undef SM_FN
+#undef SM_CAT
+#undef SM_CAT2
+#undef SM_SUFFIX
+#undef SM_W
+#undef SM_TARGET
@@ -0,0 +1,236 @@
+#ifndef trace_h
+#define trace_h
+
+/*  Low-overhead tracing of parallel tasks, written out as Chrome/Perfetto
+    trace JSON (open it at https://ui.perfetto.dev or chrome://tracing).
+
+        TRACE_SCOPE("name");                   // times the enclosing scope
+        TRACE_RANGE("name", r.begin(), r.end());  // ... and records a range
+
+    Each thread appends events to its own fixed-size ring buffer, so
+    recording takes no locks (a thread only takes a lock once, the first
+    time it records anything). If a buffer fills, the oldest events are
+    overwritten. Timestamps are in nanoseconds from a monotonic clock.
+
+    When the program exits, every buffer is written to the file named by
+    the TRACE_FILE environment variable (default "trace.json"). Each task
+    appears as a bar on the row of the thread that ran it, so idle gaps,
+    work moving between threads and load imbalance are visible.
+
+    Tracing is compiled in only when ENABLE_TRACE is defined, e.g.
+
+        g++ --std=c++14 -O3 -DENABLE_TRACE -I../../include parallel_reduce.cpp -ltbb
+
+    Otherwise the macros expand to nothing and cost nothing. The buffer
+    size (in events per thread) can be set with -DTRACE_BUFFER_EVENTS=n,
+    and must be a power of two.
+
+    The macros work the same in TBB tasks, OpenMP regions and plain threads.
+*/
+
+#ifdef ENABLE_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifndef TRACE_BUFFER_EVENTS
+#define TRACE_BUFFER_EVENTS 65536
+#endif
+
+namespace trace
+{
+
+namespace detail
+{
+    static_assert((TRACE_BUFFER_EVENTS & (TRACE_BUFFER_EVENTS - 1)) == 0,
+                  "TRACE_BUFFER_EVENTS must be a power of two");
+
+    /** Return the current time in nanoseconds */
+    inline int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /** A single completed task: its name, start and end times and the
+        (optional) range of indices it processed */
+    struct event
+    {
+        const char *name;
+        int64_t start, finish;
+        int64_t begin, end;
+    };
+
+    /** Fixed-size ring of events, written only by its owning thread */
+    class buffer
+    {
+    public:
+        // events are left uninitialised, so pages are only faulted in as they are used
+        buffer(int tid) : tid(tid), head(0), events(new event[TRACE_BUFFER_EVENTS])
+        {}
+
+        void record(const event &e)
+        {
+            uint64_t h = head.load(std::memory_order_relaxed);
+            events[h & (TRACE_BUFFER_EVENTS - 1)] = e;
+            head.store(h + 1, std::memory_order_release);
+        }
+
+        int tid;
+        std::atomic<uint64_t> head;
+        std::unique_ptr<event[]> events;
+    };
+
+    /** Owns every thread's buffer and writes them all out at exit */
+    class registry
+    {
+    public:
+        registry() : epoch(now())
+        {}
+
+        ~registry()
+        {
+            write();
+        }
+
+        buffer* add_thread()
+        {
+            std::lock_guard<std::mutex> lock(m);
+            buffers.emplace_back(new buffer(static_cast<int>(buffers.size())));
+            return buffers.back().get();
+        }
+
+        void write()
+        {
+            std::lock_guard<std::mutex> lock(m);
+
+            const char *filename = std::getenv("TRACE_FILE");
+
+            if (filename == nullptr)
+            {
+                filename = "trace.json";
+            }
+
+            FILE *f = std::fopen(filename, "w");
+
+            if (f == nullptr)
+            {
+                std::fprintf(stderr, "trace: could not open %s\n", filename);
+                return;
+            }
+
+            std::fprintf(f, "{\"traceEvents\":[\n");
+
+            bool first = true;
+
+            for (const auto &b : buffers)
+            {
+                std::fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+                                "\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                             first ? "" : ",\n", b->tid, b->tid);
+                first = false;
+
+                uint64_t h = b->head.load(std::memory_order_acquire);
+                uint64_t start = (h > TRACE_BUFFER_EVENTS) ? h - TRACE_BUFFER_EVENTS : 0;
+
+                for (uint64_t i=start; i<h; ++i)
+                {
+                    const event &e = b->events[i & (TRACE_BUFFER_EVENTS - 1)];
+
+                    // chrome traces use microseconds
+                    std::fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,"
+                                    "\"ts\":%.3f,\"dur\":%.3f",
+                                 e.name, b->tid, (e.start - epoch) * 1e-3,
+                                 (e.finish - e.start) * 1e-3);
+
+                    if (e.begin != e.end)
+                    {
+                        std::fprintf(f, ",\"args\":{\"begin\":%lld,\"end\":%lld,\"size\":%lld}",
+                                     (long long)e.begin, (long long)e.end,
+                                     (long long)(e.end - e.begin));
+                    }
+
+                    std::fprintf(f, "}");
+                }
+
+                if (start > 0)
+                {
+                    std::fprintf(stderr, "trace: thread %d dropped its oldest %llu events\n",
+                                 b->tid, (unsigned long long)start);
+                }
+            }
+
+            std::fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+            std::fclose(f);
+        }
+
+        int64_t epoch;
+
+    private:
+        std::mutex m;
+        std::vector<std::unique_ptr<buffer>> buffers;
+    };
+
+    inline registry& get_registry()
+    {
+        static registry r;
+        return r;
+    }
+
+    /** Return this thread's buffer, registering it the first time */
+    inline buffer* this_thread_buffer()
+    {
+        static thread_local buffer *b = get_registry().add_thread();
+        return b;
+    }
+}
+
+/** Records one event covering the lifetime of this object */
+class scope
+{
+public:
+    scope(const char *name, int64_t begin=0, int64_t end=0)
+        : b(detail::this_thread_buffer())
+    {
+        e.name = name;
+        e.begin = begin;
+        e.end = end;
+        e.start = detail::now();
+    }
+
+    ~scope()
+    {
+        e.finish = detail::now();
+        b->record(e);
+    }
+
+private:
+    detail::buffer *b;
+    detail::event e;
+};
+
+} // end of namespace trace
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+
+#define TRACE_SCOPE(name) \
+    trace::scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#define TRACE_RANGE(name, begin, end) \
+    trace::scope TRACE_CONCAT(trace_scope_, __LINE__)(name, begin, end)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_RANGE(name, begin, end)
+
+#endif
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef abc_h
+#define abc_h
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include "rng.h"
+
+// approximate Bayesian computation for log r of the Ricker model with
+// log-normal observation noise (as in rickerSimul_Rcpp and synllk_Rcpp),
+// with a uniform prior on log r. The distance between a simulated series
+// and the data is the root mean square difference of their logs. Its
+// running sum of squares only grows, so a simulation stops as soon as it
+// exceeds the tolerance: in a late SMC generation most proposals are
+// rejected after a few steps instead of n.
+//
+// Every proposal draws from its own Philox stream, so the results depend
+// only on the seed, not on the number of threads
+namespace abc {
+
+struct settings {
+    double lower = 0, upper = 5;    // uniform prior on log r
+    int nburn = 100;
+    double sig = 0.1;               // sd of the log observation noise
+};
+
+// the sum of squared differences between log y and the logs of a series
+// simulated with log r = logr, or INFINITY once it exceeds 'limit'. 'steps'
+// is increased by the number of observations simulated
+template <class RNG>
+double sum_squares(double logr, const std::vector<double> &logy, const settings &opts,
+                   double limit, RNG &rng, long &steps){
+    const double r = std::exp(logr);
+    double yx = 10.0 * rng.uniform();
+
+    // burn-in (nburn + 1 steps, as in rickerSimul_Rcpp)
+    for(int j=0; j<=opts.nburn; j++){
+        yx = r * yx * std::exp(-yx);
+    }
+
+    double ss = 0;
+
+    for(size_t j=0; j<logy.size(); j++){
+        if(j > 0){
+            yx = r * yx * std::exp(-yx);
+        }
+
+        double d = std::log(yx) + opts.sig * rng.normal() - logy[j];
+        ss += d * d;
+        steps++;
+
+        if(ss > limit){
+            return INFINITY;
+        }
+    }
+
+    return ss;
+}
+
+// a set of weighted parameter values with their distances. SMC keeps two
+// and swaps them between generations, so after the first generation
+// nothing is allocated
+struct population {
+    std::vector<double> theta, dist, weight;
+
+    void resize(int n){
+        theta.resize(n);
+        dist.resize(n);
+        weight.resize(n);
+    }
+};
+
+struct result {
+    population pop;
+    std::vector<double> eps;         // tolerance of each generation
+    std::vector<double> accept;      // acceptance rate of each generation
+    long simulations = 0;
+    long steps = 0;                  // observation steps simulated, over all simulations
+    bool stalled = false;            // a generation hit max_attempts
+};
+
+// rejection ABC: 'nprop' draws from the prior, keeping those within 'eps'
+inline result rejection(const std::vector<double> &logy, long nprop, double eps,
+                        const settings &opts, uint64_t seed){
+    const double limit = eps * eps * logy.size();
+
+    std::vector<double> dist(nprop);
+    std::vector<double> theta(nprop);
+    std::vector<long> steps(nprop, 0);
+
+    tbb::parallel_for(tbb::blocked_range<long>(0, nprop, 256), [&](tbb::blocked_range<long> range){
+        for(long i=range.begin(); i<range.end(); i++){
+            rng::philox g(seed, uint64_t(i));
+            theta[i] = opts.lower + (opts.upper - opts.lower) * g.uniform();
+            dist[i] = std::sqrt(sum_squares(theta[i], logy, opts, limit, g, steps[i]) / logy.size());
+        }
+    });
+
+    result res;
+    for(long i=0; i<nprop; i++){
+        if(dist[i] <= eps){
+            res.pop.theta.push_back(theta[i]);
+            res.pop.dist.push_back(dist[i]);
+        }
+        res.steps += steps[i];
+    }
+
+    res.pop.weight.assign(res.pop.theta.size(), 1.0 / std::max<size_t>(1, res.pop.theta.size()));
+    res.eps.push_back(eps);
+    res.accept.push_back(nprop > 0 ? double(res.pop.theta.size()) / nprop : NAN);
+    res.simulations = nprop;
+
+    return res;
+}
+
+// SMC-ABC (Beaumont et al., Biometrika 2009) with an adaptive schedule: the
+// tolerance of each generation is the 'alpha' quantile of the distances of
+// the last one. New particles are drawn from the weighted population,
+// moved by a Gaussian kernel with twice its variance and simulated until
+// one is within the tolerance. Stops when the tolerance reaches eps_min,
+// after max_generations, when the acceptance rate falls below
+// min_accept, or when a particle needs more than max_attempts proposals
+inline result smc(const std::vector<double> &logy, int nparticles, double alpha, double eps_min,
+                  int max_generations, double min_accept, long max_attempts,
+                  const settings &opts, uint64_t seed){
+    const int N = nparticles;
+    const double n = logy.size();
+
+    population cur, next;
+    cur.resize(N);
+    next.resize(N);
+
+    std::vector<long> attempts(N), steps(N);
+    std::vector<double> cum(N);
+
+    result res;
+
+    // generation 0: the prior
+    tbb::parallel_for(tbb::blocked_range<int>(0, N, 64), [&](tbb::blocked_range<int> range){
+        for(int i=range.begin(); i<range.end(); i++){
+            rng::philox g(seed, uint64_t(i));
+            long s = 0;
+            cur.theta[i] = opts.lower + (opts.upper - opts.lower) * g.uniform();
+            cur.dist[i] = std::sqrt(sum_squares(cur.theta[i], logy, opts, INFINITY, g, s) / n);
+            cur.weight[i] = 1.0 / N;
+            steps[i] = s;
+        }
+    });
+
+    res.eps.push_back(INFINITY);
+    res.accept.push_back(1.0);
+    res.simulations = N;
+    for(long s : steps){
+        res.steps += s;
+    }
+
+    for(int gen=1; gen<max_generations; gen++){
+        // the next tolerance
+        std::copy(cur.dist.begin(), cur.dist.end(), cum.begin());
+        std::nth_element(cum.begin(), cum.begin() + int(alpha * (N - 1)), cum.end());
+        double eps = std::max(eps_min, cum[int(alpha * (N - 1))]);
+
+        if(eps >= res.eps.back()){
+            break;
+        }
+
+        const double limit = eps * eps * n;
+
+        // kernel sd, and the cumulative weights for drawing ancestors
+        double mean = 0, var = 0, total = 0;
+        for(int i=0; i<N; i++){
+            mean += cur.weight[i] * cur.theta[i];
+        }
+        for(int i=0; i<N; i++){
+            var += cur.weight[i] * (cur.theta[i] - mean) * (cur.theta[i] - mean);
+            total += cur.weight[i];
+            cum[i] = total;
+        }
+        const double tau = std::sqrt(2.0 * var);
+
+        std::atomic<bool> stalled(false);
+
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, 16), [&](tbb::blocked_range<int> range){
+            for(int i=range.begin(); i<range.end(); i++){
+                rng::philox g(seed, (uint64_t(gen) << 32) | uint64_t(i));
+                long a = 0, s = 0;
+
+                while(!stalled.load(std::memory_order_relaxed)){
+                    if(++a > max_attempts){
+                        stalled = true;
+                        break;
+                    }
+
+                    const double u = total * g.uniform();
+                    const int k = std::min<int>(N - 1, std::upper_bound(cum.begin(), cum.end(), u) - cum.begin());
+                    const double theta = cur.theta[k] + tau * g.normal();
+
+                    if(theta < opts.lower || theta > opts.upper){
+                        continue;
+                    }
+
+                    double ss = sum_squares(theta, logy, opts, limit, g, s);
+                    if(ss <= limit){
+                        next.theta[i] = theta;
+                        next.dist[i] = std::sqrt(ss / n);
+                        break;
+                    }
+                }
+
+                attempts[i] = a;
+                steps[i] = s;
+            }
+        });
+
+        long tried = 0;
+        for(int i=0; i<N; i++){
+            tried += attempts[i];
+            res.steps += steps[i];
+        }
+        res.simulations += tried;
+
+        if(stalled){
+            res.stalled = true;
+            break;
+        }
+
+        // importance weights: prior (flat) over the mixture of kernels
+        // centred on the last population
+        const double inv_tau = 1.0 / tau;
+        tbb::parallel_for(tbb::blocked_range<int>(0, N, 64), [&](tbb::blocked_range<int> range){
+            for(int i=range.begin(); i<range.end(); i++){
+                double q = 0;
+                for(int j=0; j<N; j++){
+                    double z = (next.theta[i] - cur.theta[j]) * inv_tau;
+                    q += cur.weight[j] * std::exp(-0.5 * z * z);
+                }
+                next.weight[i] = 1.0 / q;
+            }
+        });
+
+        double wsum = 0;
+        for(double w : next.weight){
+            wsum += w;
+        }
+        for(double &w : next.weight){
+            w /= wsum;
+        }
+
+        std::swap(cur, next);
+        res.eps.push_back(eps);
+        res.accept.push_back(double(N) / tried);
+
+        if(eps <= eps_min || double(N) / tried < min_accept){
+            break;
+        }
+    }
+
+    res.pop = cur;
+    return res;
+}
+
+}
+
+#endif
@@ -0,0 +1,339 @@
+#ifndef ad_h
+#define ad_h
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// reverse-mode automatic differentiation with a tape. Write the function as
+// a template,
+//
+//     struct f {
+//         template <class T>
+//         T operator()(const std::vector<T> &x) const { return exp(-x[0] * x[1]); }
+//     };
+//
+// and ad::gradient(f(), x, grad) returns f(x) and fills grad. Every
+// operation on an ad::var appends a node (its partial derivatives with
+// respect to its inputs) to the thread's tape. The tape is an arena: it is
+// cleared, not freed, between gradients, so once it has grown to the size
+// of the function no more memory is allocated
+namespace ad {
+
+class tape {
+public:
+    // add a node with 'n' inputs, whose ids and partials are filled in by
+    // the caller through the returned pointers
+    int push(int n, int **ids, double **partials){
+        int id = nodes.size();
+        nodes.push_back(int(edge_ids.size()));
+        edge_ids.resize(edge_ids.size() + n);
+        edge_partials.resize(edge_partials.size() + n);
+        *ids = edge_ids.data() + edge_ids.size() - n;
+        *partials = edge_partials.data() + edge_partials.size() - n;
+        return id;
+    }
+
+    int push_input(){
+        int id = nodes.size();
+        nodes.push_back(int(edge_ids.size()));
+        return id;
+    }
+
+    // set adjoints[i] = d(node 'out')/d(node i) for every node
+    const std::vector<double>& backward(int out){
+        const int n = nodes.size();
+
+        adjoints.assign(n, 0.0);
+        adjoints[out] = 1.0;
+
+        for(int i=out; i>=0; i--){
+            const double a = adjoints[i];
+            if(a == 0.0){
+                continue;
+            }
+
+            const int end = (i + 1 < n) ? nodes[i+1] : int(edge_ids.size());
+            for(int e=nodes[i]; e<end; e++){
+                adjoints[edge_ids[e]] += edge_partials[e] * a;
+            }
+        }
+
+        return adjoints;
+    }
+
+    // forget every node, keeping the memory
+    void clear(){
+        nodes.clear();
+        edge_ids.clear();
+        edge_partials.clear();
+    }
+
+    size_t size() const { return nodes.size(); }
+
+private:
+    std::vector<int> nodes;             // index of each node's first edge
+    std::vector<int> edge_ids;          // input node of each edge
+    std::vector<double> edge_partials;  // d(node)/d(input) of each edge
+    std::vector<double> adjoints;
+};
+
+// the tape that new vars are recorded on, one per thread
+inline tape& active_tape(){
+    static thread_local tape t;
+    return t;
+}
+
+class var {
+public:
+    var() : val(0), id(-1) {}
+    var(double x) : val(x), id(-1) {}    // a constant: not on the tape
+
+    var(double x, int id) : val(x), id(id) {}
+
+    double value() const { return val; }
+    int index() const { return id; }
+    bool constant() const { return id < 0; }
+
+    var& operator+=(const var &b);
+    var& operator-=(const var &b);
+    var& operator*=(const var &b);
+    var& operator/=(const var &b);
+
+private:
+    double val;
+    int id;
+};
+
+namespace detail {
+    // a node with inputs a (and b), skipping inputs that are constants
+    inline var unary(double val, const var &a, double da){
+        if(a.constant()){
+            return var(val);
+        }
+        int *ids;
+        double *partials;
+        int id = active_tape().push(1, &ids, &partials);
+        ids[0] = a.index();
+        partials[0] = da;
+        return var(val, id);
+    }
+
+    inline var binary(double val, const var &a, double da, const var &b, double db){
+        if(a.constant()){
+            return unary(val, b, db);
+        }
+        else if(b.constant()){
+            return unary(val, a, da);
+        }
+        int *ids;
+        double *partials;
+        int id = active_tape().push(2, &ids, &partials);
+        ids[0] = a.index();
+        partials[0] = da;
+        ids[1] = b.index();
+        partials[1] = db;
+        return var(val, id);
+    }
+}
+
+inline var operator+(const var &a, const var &b){
+    return detail::binary(a.value() + b.value(), a, 1.0, b, 1.0);
+}
+
+inline var operator-(const var &a, const var &b){
+    return detail::binary(a.value() - b.value(), a, 1.0, b, -1.0);
+}
+
+inline var operator*(const var &a, const var &b){
+    return detail::binary(a.value() * b.value(), a, b.value(), b, a.value());
+}
+
+inline var operator/(const var &a, const var &b){
+    const double q = a.value() / b.value();
+    return detail::binary(q, a, 1.0 / b.value(), b, -q / b.value());
+}
+
+inline var operator-(const var &a){
+    return detail::unary(-a.value(), a, -1.0);
+}
+
+inline var operator+(const var &a){
+    return a;
+}
+
+inline var& var::operator+=(const var &b){ return *this = *this + b; }
+inline var& var::operator-=(const var &b){ return *this = *this - b; }
+inline var& var::operator*=(const var &b){ return *this = *this * b; }
+inline var& var::operator/=(const var &b){ return *this = *this / b; }
+
+inline bool operator<(const var &a, const var &b){ return a.value() < b.value(); }
+inline bool operator>(const var &a, const var &b){ return a.value() > b.value(); }
+inline bool operator<=(const var &a, const var &b){ return a.value() <= b.value(); }
+inline bool operator>=(const var &a, const var &b){ return a.value() >= b.value(); }
+
+inline var exp(const var &a){
+    const double e = std::exp(a.value());
+    return detail::unary(e, a, e);
+}
+
+inline var log(const var &a){
+    return detail::unary(std::log(a.value()), a, 1.0 / a.value());
+}
+
+inline var log1p(const var &a){
+    return detail::unary(std::log1p(a.value()), a, 1.0 / (1.0 + a.value()));
+}
+
+inline var sqrt(const var &a){
+    const double s = std::sqrt(a.value());
+    return detail::unary(s, a, 0.5 / s);
+}
+
+inline var sin(const var &a){
+    return detail::unary(std::sin(a.value()), a, std::cos(a.value()));
+}
+
+inline var cos(const var &a){
+    return detail::unary(std::cos(a.value()), a, -std::sin(a.value()));
+}
+
+inline var tanh(const var &a){
+    const double t = std::tanh(a.value());
+    return detail::unary(t, a, 1.0 - t * t);
+}
+
+inline var pow(const var &a, double b){
+    return detail::unary(std::pow(a.value(), b), a, b * std::pow(a.value(), b - 1.0));
+}
+
+inline double pow(double a, double b){
+    return std::pow(a, b);
+}
+
+inline var square(const var &a){
+    return detail::unary(a.value() * a.value(), a, 2.0 * a.value());
+}
+
+inline double square(double a){
+    return a * a;
+}
+
+// log(1 + exp(a)) without overflow
+inline var log1p_exp(const var &a){
+    const double x = a.value();
+    const double val = (x > 0) ? x + std::log1p(std::exp(-x)) : std::log1p(std::exp(x));
+    return detail::unary(val, a, 1.0 / (1.0 + std::exp(-x)));
+}
+
+inline double log1p_exp(double x){
+    return (x > 0) ? x + std::log1p(std::exp(-x)) : std::log1p(std::exp(x));
+}
+
+// sum_i a[i] * x[i] for constant a, as a single node
+inline var dot(const double *a, const std::vector<var> &x){
+    double val = 0;
+    int n = 0;
+    for(size_t i=0; i<x.size(); i++){
+        val += a[i] * x[i].value();
+        n += !x[i].constant();
+    }
+
+    if(n == 0){
+        return var(val);
+    }
+
+    int *ids;
+    double *partials;
+    int id = active_tape().push(n, &ids, &partials);
+
+    for(size_t i=0; i<x.size(); i++){
+        if(!x[i].constant()){
+            *ids++ = x[i].index();
+            *partials++ = a[i];
+        }
+    }
+
+    return var(val, id);
+}
+
+inline double dot(const double *a, const std::vector<double> &x){
+    double val = 0;
+    for(size_t i=0; i<x.size(); i++){
+        val += a[i] * x[i];
+    }
+    return val;
+}
+
+// sum of a vector, as a single node
+inline var sum(const std::vector<var> &x){
+    double val = 0;
+    int n = 0;
+    for(const var &xi : x){
+        val += xi.value();
+        n += !xi.constant();
+    }
+
+    if(n == 0){
+        return var(val);
+    }
+
+    int *ids;
+    double *partials;
+    int id = active_tape().push(n, &ids, &partials);
+
+    for(const var &xi : x){
+        if(!xi.constant()){
+            *ids++ = xi.index();
+            *partials++ = 1.0;
+        }
+    }
+
+    return var(val, id);
+}
+
+inline double sum(const std::vector<double> &x){
+    double val = 0;
+    for(double xi : x){
+        val += xi;
+    }
+    return val;
+}
+
+inline double value(double x){ return x; }
+inline double value(const var &x){ return x.value(); }
+
+// returns f(x) and sets grad to its gradient, reusing the thread's tape
+template <class F>
+double gradient(const F &f, const std::vector<double> &x, std::vector<double> &grad){
+    tape &t = active_tape();
+    t.clear();
+
+    static thread_local std::vector<var> inputs;
+    inputs.resize(x.size());
+
+    for(size_t i=0; i<x.size(); i++){
+        inputs[i] = var(x[i], t.push_input());
+    }
+
+    var y = f(inputs);
+
+    grad.resize(x.size());
+
+    if(y.constant()){
+        std::fill(grad.begin(), grad.end(), 0.0);
+        return y.value();
+    }
+
+    const std::vector<double> &adj = t.backward(y.index());
+
+    for(size_t i=0; i<x.size(); i++){
+        grad[i] = adj[inputs[i].index()];
+    }
+
+    return y.value();
+}
+
+}
+
+#endif
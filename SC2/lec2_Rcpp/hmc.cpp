@@ -0,0 +1,131 @@
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include "hmc.h"
+#include "rng.h"
+
+// log posterior of a logistic regression with independent N(0, prior_sd^2)
+// priors on the coefficients, written once as a template: it is evaluated
+// with T = ad::var to get the gradient. X is stored row by row
+struct logistic_regression {
+    std::vector<double> X, y;
+    int n, d;
+    double prior_sd;
+
+    template <class T>
+    T operator()(const std::vector<T> &beta) const {
+        T lp = 0;
+
+        for(int j=0; j<d; j++){
+            lp -= 0.5 * beta[j] * beta[j] / (prior_sd * prior_sd);
+        }
+
+        for(int i=0; i<n; i++){
+            T eta = ad::dot(&X[i * d], beta);
+            lp += y[i] * eta - ad::log1p_exp(eta);
+        }
+
+        return lp;
+    }
+};
+
+// Gaussian log-density with precision matrix Q (stored row by row)
+struct gaussian {
+    std::vector<double> Q;
+    int d;
+
+    template <class T>
+    T operator()(const std::vector<T> &x) const {
+        T lp = 0;
+
+        for(int i=0; i<d; i++){
+            lp -= 0.5 * x[i] * ad::dot(&Q[i * d], x);
+        }
+
+        return lp;
+    }
+};
+
+// [[Rcpp::export]]
+XPtr<hmc::model> logistic_model(NumericMatrix X, NumericVector y, double prior_sd = 10){
+    logistic_regression f;
+    f.n = X.nrow();
+    f.d = X.ncol();
+    f.prior_sd = prior_sd;
+    f.y = as<std::vector<double>>(y);
+    f.X.resize(f.n * f.d);
+
+    for(int i=0; i<f.n; i++){
+        for(int j=0; j<f.d; j++){
+            f.X[i * f.d + j] = X(i, j);
+        }
+    }
+
+    return XPtr<hmc::model>(new hmc::ad_model<logistic_regression>(f, f.d), true);
+}
+
+// [[Rcpp::export]]
+XPtr<hmc::model> gaussian_model(NumericMatrix Q){
+    gaussian f;
+    f.d = Q.nrow();
+    f.Q.resize(f.d * f.d);
+
+    for(int i=0; i<f.d; i++){
+        for(int j=0; j<f.d; j++){
+            f.Q[i * f.d + j] = Q(i, j);
+        }
+    }
+
+    return XPtr<hmc::model>(new hmc::ad_model<gaussian>(f, f.d), true);
+}
+
+// n draws (after 'warmup' iterations of adaptation) from a model created by
+// logistic_model or gaussian_model, with NUTS or with static HMC taking
+// 'nleapfrog' steps per iteration
+// [[Rcpp::export]]
+List hmc_sample(SEXP model, NumericVector init, int n, int warmup = 1000, bool nuts = true,
+                int nleapfrog = 10, double delta = 0.8, int max_depth = 10, double seed = -1){
+    XPtr<hmc::model> m(model);
+
+    if(init.size() != m->dim()){
+        stop("init must have length %d", m->dim());
+    }
+
+    if(n < 0 || warmup < 0){
+        stop("n and warmup must be non-negative");
+    }
+
+    if(nleapfrog < 1 || max_depth < 1){
+        stop("nleapfrog and max_depth must be at least 1");
+    }
+
+    if(!(delta > 0 && delta < 1)){
+        stop("delta must be in (0, 1)");
+    }
+
+    if(seed < 0){
+        seed = std::floor(unif_rand() * 4294967296.0);
+    }
+
+    hmc::settings opts;
+    opts.nuts = nuts;
+    opts.nleapfrog = nleapfrog;
+    opts.delta = delta;
+    opts.max_depth = max_depth;
+    opts.warmup = warmup;
+
+    rng::philox rng(uint64_t(seed), 0);
+    hmc::sampler<rng::philox> sampler(*m, rng, opts);
+
+    // one column per draw while sampling, transposed to one row per draw at the end
+    NumericMatrix draws(m->dim(), n);
+    hmc::stats s = sampler.run(as<std::vector<double>>(init), n, draws.begin());
+
+    return List::create(Named("samples") = transpose(draws),
+                        Named("step_size") = s.step_size,
+                        Named("inv_metric") = wrap(s.inv_metric),
+                        Named("accept") = s.accept,
+                        Named("mean_leapfrog") = s.mean_leapfrog,
+                        Named("gradients") = double(s.gradients),
+                        Named("divergences") = double(s.divergences));
+}
@@ -0,0 +1,410 @@
+#ifndef hmc_h
+#define hmc_h
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "ad.h"
+
+// Hamiltonian Monte Carlo: static HMC (a fixed number of leapfrog steps) and
+// the No-U-Turn Sampler (Hoffman and Gelman, JMLR 2014, algorithm 6), with
+// the step size tuned by dual averaging and a diagonal metric estimated
+// during warmup. Gradients come from ad.h, so a model is just a log-density
+// template (see ad::gradient). All the vectors used by the trajectories are
+// allocated once, when the sampler is created
+namespace hmc {
+
+// a log-density with its gradient, passed to R as XPtr<hmc::model>
+class model {
+public:
+    virtual ~model() {}
+    virtual int dim() const = 0;
+    virtual double log_density_grad(const std::vector<double> &q, std::vector<double> &grad) = 0;
+};
+
+// a model from a log-density template F, differentiated with ad.h
+template <class F>
+class ad_model : public model {
+public:
+    ad_model(const F &f, int d) : f(f), d(d) {}
+
+    int dim() const { return d; }
+
+    double log_density_grad(const std::vector<double> &q, std::vector<double> &grad){
+        return ad::gradient(f, q, grad);
+    }
+
+private:
+    F f;
+    int d;
+};
+
+// position, momentum, gradient and log-density at one point of a trajectory
+struct point {
+    point(int d = 0) : q(d), p(d), g(d), lp(0) {}
+    std::vector<double> q, p, g;
+    double lp;
+};
+
+// dual averaging of log(step size) towards a mean acceptance statistic of 'delta'
+class dual_averaging {
+public:
+    dual_averaging(double delta) : delta(delta) {
+        restart(1.0);
+    }
+
+    void restart(double eps){
+        mu = std::log(10 * eps);
+        hbar = 0;
+        log_eps = std::log(eps);
+        log_eps_bar = 0;
+        m = 0;
+    }
+
+    // returns the step size to use next
+    double update(double alpha){
+        m++;
+        const double eta = 1.0 / (m + 10.0);
+        hbar = (1 - eta) * hbar + eta * (delta - alpha);
+        log_eps = mu - std::sqrt(double(m)) / 0.05 * hbar;
+
+        const double w = std::pow(double(m), -0.75);
+        log_eps_bar = w * log_eps + (1 - w) * log_eps_bar;
+
+        return std::exp(log_eps);
+    }
+
+    // the step size to use after warmup
+    double final_step_size() const {
+        return std::exp(log_eps_bar);
+    }
+
+private:
+    double delta, mu, hbar, log_eps, log_eps_bar;
+    long m;
+};
+
+struct settings {
+    bool nuts = true;
+    int nleapfrog = 10;      // for static HMC
+    int max_depth = 10;      // for NUTS
+    double delta = 0.8;      // target acceptance statistic
+    long warmup = 1000;
+};
+
+struct stats {
+    double step_size = 0;
+    std::vector<double> inv_metric;
+    double accept = 0;       // mean acceptance statistic after warmup
+    double mean_leapfrog = 0;
+    long gradients = 0;
+    long divergences = 0;    // divergent transitions after warmup
+};
+
+template <class RNG>
+class sampler {
+public:
+    sampler(model &m, RNG &rng, const settings &opts)
+        : m(m), rng(rng), opts(opts), d(m.dim()), inv_metric(d, 1.0), eps(1.0),
+          current(d), minus(d), plus(d), proposal(d), tree(opts.max_depth + 1, subtree(d)),
+          ngrad(0), diverged(false) {}
+
+    // run warmup then n iterations from 'init', writing the draws (after
+    // warmup) to samples, d values per draw
+    stats run(const std::vector<double> &init, long n, double *samples){
+        current.q = init;
+        current.lp = m.log_density_grad(current.q, current.g);
+        ngrad = 1;
+
+        eps = initial_step_size();
+        dual_averaging da(opts.delta);
+        da.restart(eps);
+
+        // the metric is estimated from the draws in the middle of warmup
+        const long window_start = long(0.15 * opts.warmup);
+        const long window_end = long(0.9 * opts.warmup);
+
+        std::vector<double> mean(d, 0.0), m2(d, 0.0);
+        long nwindow = 0;
+
+        stats s;
+        double sum_alpha = 0;
+        long sum_leapfrog = 0;
+        long ndivergent = 0;
+
+        for(long i=0; i<opts.warmup + n; i++){
+            double alpha;
+            int nleapfrog;
+
+            const bool divergent = transition(alpha, nleapfrog);
+
+            if(i < opts.warmup){
+                eps = da.update(alpha);
+
+                if(i >= window_start && i < window_end){
+                    nwindow++;
+                    for(int k=0; k<d; k++){
+                        double delta = current.q[k] - mean[k];
+                        mean[k] += delta / nwindow;
+                        m2[k] += delta * (current.q[k] - mean[k]);
+                    }
+                }
+
+                if(i == window_end - 1 && nwindow > 2){
+                    // regularised towards 1e-3, as Stan does
+                    const double w = nwindow / (nwindow + 5.0);
+                    for(int k=0; k<d; k++){
+                        inv_metric[k] = w * m2[k] / (nwindow - 1) + (1 - w) * 1e-3;
+                    }
+                    eps = initial_step_size();
+                    da.restart(eps);
+                }
+
+                if(i == opts.warmup - 1){
+                    eps = da.final_step_size();
+                }
+            }
+            else {
+                sum_alpha += alpha;
+                sum_leapfrog += nleapfrog;
+                ndivergent += divergent;
+                std::copy(current.q.begin(), current.q.end(), samples + (i - opts.warmup) * d);
+            }
+        }
+
+        s.step_size = eps;
+        s.inv_metric = inv_metric;
+        s.accept = (n > 0) ? sum_alpha / n : NAN;
+        s.mean_leapfrog = (n > 0) ? double(sum_leapfrog) / n : NAN;
+        s.gradients = ngrad;
+        s.divergences = ndivergent;
+
+        return s;
+    }
+
+private:
+    // the state of a subtree built by build_tree
+    struct subtree {
+        subtree(int d) : minus(d), plus(d), prop(d), n(0), s(true), alpha(0), nalpha(0) {}
+        point minus, plus, prop;
+        double n;          // number of points in the slice
+        bool s;            // false after a U-turn or divergence
+        double alpha;      // sum of acceptance statistics
+        long nalpha;
+    };
+
+    double kinetic(const point &x) const {
+        double k = 0;
+        for(int i=0; i<d; i++){
+            k += inv_metric[i] * x.p[i] * x.p[i];
+        }
+        return 0.5 * k;
+    }
+
+    void sample_momentum(point &x){
+        for(int i=0; i<d; i++){
+            x.p[i] = rng.normal() / std::sqrt(inv_metric[i]);
+        }
+    }
+
+    void leapfrog(point &x, double step){
+        for(int i=0; i<d; i++){
+            x.p[i] += 0.5 * step * x.g[i];
+            x.q[i] += step * inv_metric[i] * x.p[i];
+        }
+
+        x.lp = m.log_density_grad(x.q, x.g);
+        ngrad++;
+
+        for(int i=0; i<d; i++){
+            x.p[i] += 0.5 * step * x.g[i];
+        }
+    }
+
+    // true if the trajectory from minus to plus is still moving apart at both ends
+    bool no_uturn(const point &a, const point &b) const {
+        double da = 0, db = 0;
+        for(int i=0; i<d; i++){
+            double dq = b.q[i] - a.q[i];
+            da += dq * inv_metric[i] * a.p[i];
+            db += dq * inv_metric[i] * b.p[i];
+        }
+        return da >= 0 && db >= 0;
+    }
+
+    // a step size for which one leapfrog step has acceptance near 0.5
+    double initial_step_size(){
+        double step = eps;
+        point &x = proposal;
+
+        auto log_ratio = [&](){
+            x = current;
+            sample_momentum(x);
+            double h0 = x.lp - kinetic(x);
+            leapfrog(x, step);
+            double h = x.lp - kinetic(x);
+            return std::isfinite(h) ? h - h0 : -INFINITY;
+        };
+
+        const int dir = (log_ratio() > std::log(0.5)) ? 1 : -1;
+
+        for(int i=0; i<50; i++){
+            double lr = log_ratio();
+            if((dir == 1 && !(lr > std::log(0.5))) || (dir == -1 && !(lr < std::log(0.5)))){
+                break;
+            }
+            step *= (dir == 1) ? 2.0 : 0.5;
+        }
+
+        return step;
+    }
+
+    // one iteration; returns whether the trajectory diverged
+    bool transition(double &alpha, int &nleapfrog){
+        const long before = ngrad;
+        diverged = false;
+
+        sample_momentum(current);
+        const double joint0 = current.lp - kinetic(current);
+
+        if(opts.nuts){
+            // slice variable, on the log scale
+            const double log_u = joint0 + std::log(1.0 - rng.uniform());
+
+            minus = current;
+            plus = current;
+            proposal = current;
+
+            double n = 1;
+            bool s = true;
+            double sum_alpha = 0;
+            long nalpha = 0;
+
+            for(int j=0; s && j<opts.max_depth; j++){
+                const int v = (rng.uniform() < 0.5) ? -1 : 1;
+
+                build_tree(v == -1 ? minus : plus, log_u, v, j, joint0);
+                subtree &t = tree[j];
+
+                if(v == -1){
+                    minus = t.minus;
+                }
+                else {
+                    plus = t.plus;
+                }
+
+                if(t.s && rng.uniform() < t.n / n){
+                    proposal = t.prop;
+                }
+
+                sum_alpha += t.alpha;
+                nalpha += t.nalpha;
+
+                n += t.n;
+                s = t.s && no_uturn(minus, plus);
+            }
+
+            current.q = proposal.q;
+            current.g = proposal.g;
+            current.lp = proposal.lp;
+
+            alpha = (nalpha > 0) ? sum_alpha / nalpha : 0;
+        }
+        else {
+            proposal = current;
+
+            // jitter the step size by +/-10%, so a trajectory length that
+            // happens to be near a period of the target can't stop it mixing
+            const double step = eps * (0.9 + 0.2 * rng.uniform());
+
+            for(int i=0; i<opts.nleapfrog; i++){
+                leapfrog(proposal, step);
+            }
+
+            const double joint = proposal.lp - kinetic(proposal);
+            alpha = std::isfinite(joint) ? std::min(1.0, std::exp(joint - joint0)) : 0;
+
+            if(!std::isfinite(joint) || joint - joint0 < -1000){
+                diverged = true;
+            }
+
+            if(rng.uniform() < alpha){
+                current.q = proposal.q;
+                current.g = proposal.g;
+                current.lp = proposal.lp;
+            }
+        }
+
+        nleapfrog = int(ngrad - before);
+        return diverged;
+    }
+
+    // build a subtree of 2^j leapfrog steps in direction v from 'start',
+    // leaving it in tree[j] (tree[0..j-1] are used as workspace)
+    void build_tree(const point &start, double log_u, int v, int j, double joint0){
+        subtree &t = tree[j];
+
+        if(j == 0){
+            t.prop = start;
+            leapfrog(t.prop, v * eps);
+
+            const double joint = t.prop.lp - kinetic(t.prop);
+            const bool finite = std::isfinite(joint);
+
+            t.n = (finite && log_u <= joint) ? 1 : 0;
+            t.s = finite && (log_u < joint + 1000);
+            t.alpha = finite ? std::min(1.0, std::exp(joint - joint0)) : 0;
+            t.nalpha = 1;
+
+            if(!t.s){
+                diverged = true;
+            }
+
+            t.minus = t.prop;
+            t.plus = t.prop;
+            return;
+        }
+
+        build_tree(start, log_u, v, j - 1, joint0);
+        t = tree[j-1];
+
+        if(!t.s){
+            return;
+        }
+
+        build_tree(v == -1 ? t.minus : t.plus, log_u, v, j - 1, joint0);
+        const subtree &other = tree[j-1];
+
+        if(other.n > 0 && rng.uniform() < other.n / (t.n + other.n)){
+            t.prop = other.prop;
+        }
+
+        if(v == -1){
+            t.minus = other.minus;
+        }
+        else {
+            t.plus = other.plus;
+        }
+
+        t.alpha += other.alpha;
+        t.nalpha += other.nalpha;
+        t.n += other.n;
+        t.s = other.s && no_uturn(t.minus, t.plus);
+    }
+
+    model &m;
+    RNG &rng;
+    settings opts;
+    int d;
+    std::vector<double> inv_metric;
+    double eps;
+    point current, minus, plus, proposal;
+    std::vector<subtree> tree;
+    long ngrad;
+    bool diverged;     // the current transition has diverged
+};
+
+}
+
+#endif
@@ -1,27 +1,244 @@
 #include <Rcpp.h>
+// [[Rcpp::depends(RcppParallel)]]
+#include <RcppParallel.h>
 using namespace Rcpp;
 
+#include "mh.h"
+#include "mh_parallel.h"
+#include "mh_sink.h"
+#include "mh_tempering.h"
+
+// draws from R's generator, so set.seed() still works
+struct r_rng {
+    double normal() { return norm_rand(); }
+    double uniform() { return unif_rand(); }
+};
+
+// lik is either an R function returning the likelihood, or a native target
+// (e.g. from synllk_target) returning the log-likelihood without calling R
 // [[Rcpp::export]]
-NumericVector metrop_Rcpp(Function lik, double init, int n, double scale){
-    double proposal;
+NumericVector metrop_Rcpp(SEXP lik, double init, int n, double scale){
+    NumericVector samples(n);
+    r_rng rng;
 
-    NumericVector samples(n);    
-    NumericVector alpha(n);
+    if(n < 1){
+        return samples;
+    }
 
-    samples[0] = init;
+    if(TYPEOF(lik) == EXTPTRSXP){
+        XPtr<mh::target> target(lik);
+
+        mh::metropolis([&](double x){ return target->log_density(x); },
+                       init, n, scale, rng, samples.begin());
+    }
+    else {
+        Function f(lik);
 
-    for(int i=1; i<n; i++){
-        proposal = R::rnorm(samples[i-1], sqrt(scale));
+        mh::metropolis([&](double x){ return std::log(as<double>(f(x))); },
+                       init, n, scale, rng, samples.begin());
+    }
 
-        alpha[i] = as<double>(lik(proposal))/as<double>(lik(samples[i-1]));
+    return samples;
+}
 
-        if(R::runif(0,1) < alpha[i]){
-            samples[i] = proposal;
-        }
-        else {
-            samples[i] = samples[i-1];
+// as metrop_Rcpp, but the chain is never held in memory: every thin'th
+// sample is written to 'file' (if given) a chunk at a time, and the mean,
+// variance and quantiles of all n samples are kept as it runs. n is a double
+// so that runs can go past 2^31 iterations
+// [[Rcpp::export]]
+List metrop_stream(SEXP lik, double init, double n, double scale, double thin = 1,
+                   std::string file = "", int chunk = 65536){
+    if(thin < 1 || chunk < 1){
+        stop("thin and chunk must be at least 1");
+    }
+
+    r_rng rng;
+    mh::chain_sink sink(1, long(thin), file, chunk);
+
+    if(TYPEOF(lik) == EXTPTRSXP){
+        XPtr<mh::target> target(lik);
+
+        mh::metropolis_stream([&](double x){ return target->log_density(x); },
+                              init, long(n), scale, rng, sink);
+    }
+    else {
+        Function f(lik);
+
+        mh::metropolis_stream([&](double x){ return std::log(as<double>(f(x))); },
+                              init, long(n), scale, rng, sink);
+    }
+
+    sink.close();
+
+    NumericVector quantiles(sink.quantile_probs().size());
+    CharacterVector names(quantiles.size());
+
+    for(int i=0; i<quantiles.size(); i++){
+        quantiles[i] = sink.quantile(0, i);
+        char name[16];
+        snprintf(name, sizeof(name), "%g%%", 100 * sink.quantile_probs()[i]);
+        names[i] = name;
+    }
+    quantiles.names() = names;
+
+    return List::create(Named("n") = double(sink.draws()),
+                        Named("kept") = double(sink.kept()),
+                        Named("mean") = sink.mean(0),
+                        Named("var") = sink.variance(0),
+                        Named("quantiles") = quantiles,
+                        Named("file") = file);
+}
+
+// reads 'count' samples (all of them if count < 0) from a chain file written
+// by metrop_stream, starting at sample 'start' (0-based). The file is mapped
+// into memory, so only the samples asked for are read
+// [[Rcpp::export]]
+NumericMatrix read_chain(std::string file, double start = 0, double count = -1){
+    if(start < 0){
+        stop("start must be non-negative");
+    }
+
+    mh::chain_file chain(file);
+
+    long first = std::min<long>(long(start), chain.size());
+    long n = (count < 0) ? chain.size() - first : std::min<long>(long(count), chain.size() - first);
+
+    NumericMatrix out(n, chain.dim());
+
+    for(long i=0; i<n; i++){
+        const double *row = chain.row(first + i);
+        for(int j=0; j<chain.dim(); j++){
+            out(i, j) = row[j];
         }
     }
 
-    return samples;
-}
\ No newline at end of file
+    return out;
+}
+
+// runs one chain per value of init in parallel until every chain has an
+// effective sample size of at least target_ess. lik must be a thread-safe
+// native target (e.g. synllk_target); each chain has its own Philox stream,
+// seeded from R's generator unless seed is given
+// [[Rcpp::export]]
+List metrop_parallel(SEXP lik, NumericVector init, double scale, double target_ess,
+                     int max_iter = 1000000, int check_every = 100, double seed = -1){
+    if(TYPEOF(lik) != EXTPTRSXP){
+        stop("metrop_parallel needs a native target: R functions can't be called from other threads");
+    }
+
+    XPtr<mh::target> target(lik);
+
+    if(!target->thread_safe()){
+        stop("this target can't be used from several threads");
+    }
+
+    if(max_iter < 1 || check_every < 1){
+        stop("max_iter and check_every must be at least 1");
+    }
+
+    if(seed < 0){
+        seed = std::floor(unif_rand() * 4294967296.0);
+    }
+
+    mh::chains_result res = mh::run_chains(
+        [&](double x, rng::philox &rng){ return target->log_density(x, rng); },
+        as<std::vector<double>>(init), scale, target_ess, max_iter, check_every, uint64_t(seed));
+
+    const int nchains = init.size();
+    NumericMatrix samples(res.iterations, nchains);
+
+    for(int k=0; k<nchains; k++){
+        std::copy(res.samples[k].begin(), res.samples[k].end(), samples.column(k).begin());
+    }
+
+    double total_ess = 0;
+    for(double e : res.ess){
+        total_ess += e;
+    }
+
+    return List::create(Named("samples") = samples,
+                        Named("ess") = wrap(res.ess),
+                        Named("rhat") = res.rhat,
+                        Named("iterations") = res.iterations,
+                        Named("converged") = res.converged,
+                        Named("seconds") = res.seconds,
+                        Named("ess_per_second") = total_ess / res.seconds);
+}
+
+// replica-exchange MH: ntemps replicas run in parallel at temperatures from
+// 1 up to tmax, proposing swaps between neighbours every swap_every steps.
+// The ladder adapts for the first 'adapt' swap rounds (default: the first
+// half of the run). Returns the chain at temperature 1
+// [[Rcpp::export]]
+List metrop_tempering(SEXP lik, double init, int n, double scale, int ntemps = 8,
+                      double tmax = 100, int swap_every = 10, int adapt = -1, double seed = -1){
+    if(TYPEOF(lik) != EXTPTRSXP){
+        stop("metrop_tempering needs a native target: R functions can't be called from other threads");
+    }
+
+    XPtr<mh::target> target(lik);
+
+    if(!target->thread_safe()){
+        stop("this target can't be used from several threads");
+    }
+
+    if(ntemps < 2 || tmax <= 1){
+        stop("need ntemps >= 2 and tmax > 1");
+    }
+
+    if(swap_every < 1){
+        stop("swap_every must be at least 1");
+    }
+
+    if(adapt < 0){
+        adapt = n / (2 * swap_every);
+    }
+
+    if(seed < 0){
+        seed = std::floor(unif_rand() * 4294967296.0);
+    }
+
+    // start from a geometric ladder
+    std::vector<double> betas(ntemps);
+    for(int i=0; i<ntemps; i++){
+        betas[i] = std::pow(tmax, -double(i) / (ntemps - 1));
+    }
+
+    mh::tempering_result res = mh::parallel_tempering(
+        [&](double x, rng::philox &rng){ return target->log_density(x, rng); },
+        init, n, scale, betas, swap_every, adapt, uint64_t(seed));
+
+    return List::create(Named("samples") = wrap(res.samples),
+                        Named("temperatures") = 1.0 / NumericVector(res.betas.begin(), res.betas.end()),
+                        Named("swap_accept") = wrap(res.swap_accept),
+                        Named("accept") = wrap(res.accept),
+                        Named("round_trips") = double(res.round_trips));
+}
+
+// an equal mixture of N(mu1, sd^2) and N(mu2, sd^2), for trying out the
+// samplers on a bimodal target
+class mixture_target_ : public mh::target {
+public:
+    mixture_target_(double mu1, double mu2, double sd) : mu1(mu1), mu2(mu2), sd(sd) {}
+
+    double log_density(double x){
+        double a = -0.5 * (x - mu1) * (x - mu1) / (sd * sd);
+        double b = -0.5 * (x - mu2) * (x - mu2) / (sd * sd);
+        double m = std::max(a, b);
+        return m + std::log(std::exp(a - m) + std::exp(b - m));
+    }
+
+    bool thread_safe() const { return true; }
+
+    double log_density(double x, rng::philox &){
+        return log_density(x);
+    }
+
+private:
+    double mu1, mu2, sd;
+};
+
+// [[Rcpp::export]]
+XPtr<mh::target> mixture_target(double mu1, double mu2, double sd){
+    return XPtr<mh::target>(new mixture_target_(mu1, mu2, sd), true);
+}
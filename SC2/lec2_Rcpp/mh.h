@@ -0,0 +1,58 @@
+#ifndef mh_h
+#define mh_h
+
+#include <cmath>
+
+#include "rng.h"
+
+namespace mh {
+
+// a log-density that runs entirely in C++, so the sampler never calls back
+// into R. Targets are passed to R as an external pointer (XPtr<mh::target>)
+class target {
+public:
+    virtual ~target() {}
+    virtual double log_density(double x) = 0;
+
+    // targets that can run on several threads at once (e.g. for parallel
+    // chains) also implement this version, which must not touch R: random
+    // numbers come from the philox passed in, the calling chain's own stream
+    virtual bool thread_safe() const { return false; }
+    virtual double log_density(double, rng::philox &) { return NAN; }
+};
+
+// one random-walk MH step from x, whose log-density ld is already known:
+// the proposal is accepted with probability min(1, p(proposal)/p(x)),
+// compared in log space. Updates x and ld in place
+template <class LOGDENS, class RNG>
+inline void step(LOGDENS &logdens, double sd, RNG &rng, double &x, double &ld){
+    double proposal = x + sd * rng.normal();
+    double proposal_ld = logdens(proposal);
+
+    if(std::log(rng.uniform()) < proposal_ld - ld){
+        x = proposal;
+        ld = proposal_ld;
+    }
+}
+
+// random-walk Metropolis-Hastings with proposal variance 'scale', writing n
+// samples (including 'init') to 'samples'. logdens(x) returns the log target
+// density, and is called once per iteration: the current value is cached.
+// rng needs normal() (a standard normal draw) and uniform() (on [0,1))
+template <class LOGDENS, class RNG>
+void metropolis(LOGDENS &&logdens, double init, int n, double scale, RNG &rng, double *samples){
+    const double sd = std::sqrt(scale);
+
+    double current = init;
+    double current_ld = logdens(current);
+
+    samples[0] = current;
+
+    for(int i=1; i<n; i++){
+        step(logdens, sd, rng, current, current_ld);
+        samples[i] = current;
+    }
+}
+}
+
+#endif
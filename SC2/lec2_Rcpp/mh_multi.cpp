@@ -0,0 +1,90 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+#include <RcppArmadillo.h>
+using namespace Rcpp;
+
+#include <numeric>
+
+#include "mh_multi.h"
+
+// multivariate random-walk MH. logdens is an R function returning the log
+// density of a parameter vector, or a native target (e.g. from mvn_target).
+// blocks gives the sizes of consecutive blocks of parameters updated
+// together (default: one block of everything), scale the initial proposal
+// variance of every coordinate. Proposals adapt for the first 'adapt'
+// iterations (default n/2) and are drawn 'batch' iterations at a time
+// [[Rcpp::export]]
+List metrop_multi(SEXP logdens, arma::vec init, int n, double scale = 0.1,
+                  Nullable<IntegerVector> blocks = R_NilValue, int adapt = -1, int batch = 64){
+    const arma::uword d = init.n_elem;
+
+    IntegerVector sizes = blocks.isNull() ? IntegerVector::create(int(d)) : IntegerVector(blocks);
+
+    if(std::accumulate(sizes.begin(), sizes.end(), 0) != int(d) || min(sizes) < 1){
+        stop("the block sizes must be positive and add up to length(init)");
+    }
+
+    if(batch < 1){
+        stop("batch must be at least 1");
+    }
+
+    if(adapt < 0){
+        adapt = n / 2;
+    }
+
+    std::vector<mh::mh_block> mhblocks;
+    arma::uword first = 0;
+
+    for(int size : sizes){
+        // the initial covariance counts as 10 samples per dimension
+        arma::mat cov0 = scale * arma::eye(size, size);
+        mhblocks.push_back(mh::mh_block(first, first + size - 1, cov0, 10.0 * size, batch));
+        first += size;
+    }
+
+    arma::mat samples;
+
+    if(TYPEOF(logdens) == EXTPTRSXP){
+        XPtr<mh::target_multi> target(logdens);
+
+        samples = mh::metropolis_multi([&](const arma::vec &x){ return target->log_density(x); },
+                                       init, n, mhblocks, adapt);
+    }
+    else {
+        Function f(logdens);
+        auto ld = [&](const arma::vec &x){ return as<double>(f(NumericVector(x.begin(), x.end()))); };
+
+        samples = mh::metropolis_multi(ld, init, n, mhblocks, adapt);
+    }
+
+    NumericVector accept(mhblocks.size());
+    List covariances(mhblocks.size());
+
+    for(size_t b=0; b<mhblocks.size(); b++){
+        accept[b] = double(mhblocks[b].accepted) / std::max(1, n - 1);
+        covariances[b] = mhblocks[b].covariance();
+    }
+
+    return List::create(Named("samples") = arma::mat(samples.t()),
+                        Named("accept") = accept,
+                        Named("proposal_cov") = covariances);
+}
+
+// Gaussian log-density with covariance Sigma, for testing the sampler
+class mvn_target_ : public mh::target_multi {
+public:
+    mvn_target_(const arma::mat &Sigma) : Q(arma::inv_sympd(Sigma)), work(Sigma.n_rows) {}
+
+    double log_density(const arma::vec &x){
+        work = Q * x;
+        return -0.5 * arma::dot(x, work);
+    }
+
+private:
+    arma::mat Q;
+    arma::vec work;
+};
+
+// [[Rcpp::export]]
+XPtr<mh::target_multi> mvn_target(arma::mat Sigma){
+    return XPtr<mh::target_multi>(new mvn_target_(Sigma), true);
+}
@@ -0,0 +1,157 @@
+#ifndef mh_multi_h
+#define mh_multi_h
+
+// include RcppArmadillo.h first when using this from R
+#ifndef ARMA_INCLUDES
+#include <armadillo>
+#endif
+
+#include <cmath>
+#include <vector>
+
+namespace mh {
+
+// a multivariate log-density that runs in C++ (see mh::target)
+class target_multi {
+public:
+    virtual ~target_multi() {}
+    virtual double log_density(const arma::vec &x) = 0;
+};
+
+// given lower-triangular L, overwrite it with the Cholesky factor of
+// L L' + v v' in O(d^2) (v is used as workspace)
+inline void chol_update(arma::mat &L, arma::vec &v){
+    const arma::uword d = L.n_rows;
+
+    for(arma::uword k=0; k<d; k++){
+        double lkk = L(k, k);
+        double r = std::sqrt(lkk * lkk + v[k] * v[k]);
+        double c = r / lkk;
+        double s = v[k] / lkk;
+
+        L(k, k) = r;
+
+        double *col = L.colptr(k);
+        for(arma::uword i=k+1; i<d; i++){
+            col[i] = (col[i] + s * v[i]) / c;
+            v[i] = c * v[i] - s * col[i];
+        }
+    }
+}
+
+// a contiguous block of coordinates [first, last] updated together, with its
+// own adaptive Gaussian proposal (Haario et al., Bernoulli 2001): the
+// proposal covariance is (2.38^2/k) times the running covariance of the
+// block's samples, regularised by the initial covariance with weight n0,
+//
+//     M_n = (n0 * M_0 + sum_i (x_i - mean_n)(x_i - mean_n)') / (n0 + n),
+//
+// and only its Cholesky factor is kept, updated by a rescale and a rank-1
+// update per sample rather than refactorised
+class mh_block {
+public:
+    mh_block(arma::uword first, arma::uword last, const arma::mat &cov0, double n0, int batch)
+        : first(first), last(last), n(0), n0(n0), accepted(0),
+          scale(2.38 / std::sqrt(double(last - first + 1))),
+          mean(last - first + 1, arma::fill::zeros), work(last - first + 1),
+          L(arma::chol(cov0, "lower")), incr(last - first + 1, batch), logu(batch) {}
+
+    // fill the next 'batch' proposal increments and log-uniforms at once,
+    // using the current proposal
+    void generate(){
+        incr.randn();
+        incr = arma::trimatl(L) * incr;
+        incr *= scale;
+
+        logu.randu();
+        logu = arma::log(logu);
+    }
+
+    // add the block's current value x to the running mean and covariance
+    template <class VEC>
+    void adapt(const VEC &x){
+        n += 1;
+
+        work = x - mean;
+        mean += work / n;
+
+        L *= std::sqrt((n0 + n - 1) / (n0 + n));
+
+        if(n > 1){
+            work *= std::sqrt((n - 1) / (n * (n0 + n)));
+            chol_update(L, work);
+        }
+    }
+
+    arma::mat covariance() const {
+        return L * L.t() * scale * scale;
+    }
+
+    arma::uword first, last;
+    double n, n0;
+    long accepted;
+    double scale;
+    arma::vec mean, work;
+    arma::mat L;
+    arma::mat incr;    // one column per iteration of the batch
+    arma::vec logu;
+};
+
+// random-walk MH over the blocks in turn, writing the n samples (including
+// init) as the columns of the returned matrix. Each block proposal costs
+// one evaluation of logdens; the current log-density is cached. Block
+// proposals are adapted for the first 'adapt' iterations, and are generated
+// 'batch' iterations at a time, so a batch uses the proposal as it was at
+// the start of the batch
+template <class LOGDENS>
+arma::mat metropolis_multi(LOGDENS &&logdens, const arma::vec &init, long n,
+                           std::vector<mh_block> &blocks, long adapt){
+    arma::mat samples(init.n_elem, n);
+
+    if(n < 1){
+        return samples;
+    }
+
+    arma::vec x = init;
+    arma::vec proposal = init;
+    double ld = logdens(x);
+
+    samples.col(0) = x;
+
+    const long batch = blocks.empty() ? 1 : blocks[0].incr.n_cols;
+
+    for(long i=1; i<n; i++){
+        const long j = (i - 1) % batch;
+
+        for(mh_block &b : blocks){
+            if(j == 0){
+                b.generate();
+            }
+
+            proposal.subvec(b.first, b.last) = x.subvec(b.first, b.last) + b.incr.col(j);
+
+            double proposal_ld = logdens(proposal);
+
+            if(b.logu[j] < proposal_ld - ld){
+                x.subvec(b.first, b.last) = proposal.subvec(b.first, b.last);
+                ld = proposal_ld;
+                b.accepted++;
+            }
+            else {
+                proposal.subvec(b.first, b.last) = x.subvec(b.first, b.last);
+            }
+
+            if(i <= adapt){
+                b.adapt(x.subvec(b.first, b.last));
+            }
+        }
+
+        samples.col(i) = x;
+    }
+
+    return samples;
+}
+
+}
+
+#endif
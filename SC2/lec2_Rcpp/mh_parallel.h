@@ -0,0 +1,237 @@
+#ifndef mh_parallel_h
+#define mh_parallel_h
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include "mh.h"
+#include "rng.h"
+
+namespace mh {
+
+// online summaries of one chain in at most 2*maxbatches batches: when the
+// batches fill up, neighbouring pairs are merged and the batch size doubles,
+// so memory stays fixed however long the chain runs. Batch means give the
+// effective sample size, and the first and second halves of the batches give
+// the split chains for R-hat
+class batch_means {
+public:
+    batch_means(int maxbatches = 32) : maxbatches(maxbatches), batchsize(1), nbatches(0),
+        partial_n(0), partial_sum(0), partial_sumsq(0), shift(0), started(false),
+        sums(2 * maxbatches), sumsqs(2 * maxbatches) {}
+
+    void add(double x){
+        // sums are of x - (first value), to avoid cancellation in the variances
+        if(!started){
+            shift = x;
+            started = true;
+        }
+
+        double d = x - shift;
+        partial_sum += d;
+        partial_sumsq += d * d;
+
+        if(++partial_n == batchsize){
+            sums[nbatches] = partial_sum;
+            sumsqs[nbatches] = partial_sumsq;
+            nbatches++;
+
+            partial_n = 0;
+            partial_sum = partial_sumsq = 0;
+
+            if(nbatches == 2 * maxbatches){
+                for(int j=0; j<maxbatches; j++){
+                    sums[j] = sums[2*j] + sums[2*j+1];
+                    sumsqs[j] = sumsqs[2*j] + sumsqs[2*j+1];
+                }
+                nbatches = maxbatches;
+                batchsize *= 2;
+            }
+        }
+    }
+
+    // effective sample size of the samples in complete batches, or 0 until
+    // there are enough batches to estimate it
+    double ess() const {
+        if(nbatches < maxbatches / 2){
+            return 0;
+        }
+
+        double n = double(nbatches) * batchsize;
+        double sum = 0, sumsq = 0;
+
+        for(int j=0; j<nbatches; j++){
+            sum += sums[j];
+            sumsq += sumsqs[j];
+        }
+
+        double mean = sum / n;
+        double var = (sumsq - n * mean * mean) / (n - 1);
+
+        double batchvar = 0;
+        for(int j=0; j<nbatches; j++){
+            double d = sums[j] / batchsize - mean;
+            batchvar += d * d;
+        }
+        batchvar /= (nbatches - 1);
+
+        if(var <= 0){
+            return 0;    // the chain hasn't moved
+        }
+        else if(batchvar <= 0){
+            return n;
+        }
+
+        return std::min(n, n * var / (batchsize * batchvar));
+    }
+
+    // length, mean and variance of the first (half = 0) or second (half = 1)
+    // half of the complete batches
+    void half(int h, double &n, double &mean, double &var) const {
+        int nb = nbatches / 2;
+        int first = (h == 0) ? 0 : nbatches - nb;
+
+        double sum = 0, sumsq = 0;
+        for(int j=first; j<first+nb; j++){
+            sum += sums[j];
+            sumsq += sumsqs[j];
+        }
+
+        n = double(nb) * batchsize;
+        mean = sum / n;
+        var = (sumsq - n * mean * mean) / (n - 1);
+        mean += shift;
+    }
+
+private:
+    int maxbatches, batchsize, nbatches;
+    int partial_n;
+    double partial_sum, partial_sumsq;
+    double shift;
+    bool started;
+    std::vector<double> sums, sumsqs;
+};
+
+// split-R-hat over all chains (Gelman et al., BDA3 section 11.4), each chain
+// split into its two halves; chains must all have the same length
+inline double split_rhat(const std::vector<batch_means> &stats){
+    std::vector<double> means;
+    double n = 0, w = 0;
+
+    for(const batch_means &s : stats){
+        for(int h=0; h<2; h++){
+            double mean, var;
+            s.half(h, n, mean, var);
+            means.push_back(mean);
+            w += var;
+        }
+    }
+
+    int m = means.size();
+    w /= m;
+
+    double grand = 0;
+    for(double mean : means){
+        grand += mean;
+    }
+    grand /= m;
+
+    double b = 0;
+    for(double mean : means){
+        b += (mean - grand) * (mean - grand);
+    }
+    b *= n / (m - 1);
+
+    if(!(n > 1) || !(w > 0)){
+        return NAN;
+    }
+
+    return std::sqrt(((n - 1) / n * w + b / n) / w);
+}
+
+struct chains_result {
+    std::vector<std::vector<double>> samples;    // one vector per chain
+    std::vector<double> ess;                     // per chain
+    double rhat;
+    long iterations;                             // per chain
+    bool converged;                              // every chain reached target_ess
+    double seconds;
+};
+
+// run one chain per value of 'init' in parallel, 'check_every' iterations at
+// a time, until every chain has an effective sample size of at least
+// target_ess (or max_iter iterations). logdens(x, rng) must be thread-safe;
+// chain k draws everything, including any randomness in the target, from
+// its own stream philox(seed, k), so results don't depend on the number of
+// threads or how the chains are scheduled
+template <class LOGDENS>
+chains_result run_chains(LOGDENS logdens, const std::vector<double> &init, double scale,
+                         double target_ess, long max_iter, int check_every, uint64_t seed){
+    const int nchains = init.size();
+    const double sd = std::sqrt(scale);
+
+    auto t0 = std::chrono::steady_clock::now();
+
+    std::vector<rng::philox> rngs;
+    std::vector<double> current(init), current_ld(nchains);
+    std::vector<batch_means> stats(nchains);
+
+    chains_result result;
+    result.samples.resize(nchains);
+    result.ess.assign(nchains, 0);
+    result.rhat = NAN;
+    result.iterations = 0;
+    result.converged = false;
+
+    for(int k=0; k<nchains; k++){
+        rngs.emplace_back(seed, k);
+    }
+
+    tbb::parallel_for(0, nchains, [&](int k){
+        current_ld[k] = logdens(current[k], rngs[k]);
+    });
+
+    while(result.iterations < max_iter){
+        const long m = std::min<long>(check_every, max_iter - result.iterations);
+
+        tbb::parallel_for(tbb::blocked_range<int>(0, nchains, 1), [&](tbb::blocked_range<int> r){
+            for(int k=r.begin(); k<r.end(); k++){
+                auto ld = [&](double x){ return logdens(x, rngs[k]); };
+
+                for(long i=0; i<m; i++){
+                    step(ld, sd, rngs[k], current[k], current_ld[k]);
+                    result.samples[k].push_back(current[k]);
+                    stats[k].add(current[k]);
+                }
+            }
+        });
+
+        result.iterations += m;
+
+        bool done = true;
+        for(int k=0; k<nchains; k++){
+            result.ess[k] = stats[k].ess();
+            done = done && (result.ess[k] >= target_ess);
+        }
+
+        if(done){
+            result.converged = true;
+            break;
+        }
+    }
+
+    result.rhat = split_rhat(stats);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    return result;
+}
+
+}
+
+#endif
@@ -0,0 +1,355 @@
+#ifndef mh_sink_h
+#define mh_sink_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mh.h"
+
+namespace mh {
+
+// the chain file: this 64 byte header, then the kept samples as doubles,
+// one row of 'dim' values per sample, so the file can be mmap'd (or read
+// with readBin) and indexed directly
+struct chain_header {
+    char magic[8];          // "MHCHAIN1"
+    uint32_t dim;
+    uint32_t reserved;
+    uint64_t nsamples;      // rows written so far, updated at every flush
+    uint64_t thin;
+    char padding[32];
+};
+
+static_assert(sizeof(chain_header) == 64, "chain_header must be 64 bytes");
+
+// running estimate of one quantile in constant memory, using the P-squared
+// algorithm (Jain and Chlamtac, CACM 1985): five markers whose heights are
+// adjusted with a piecewise-parabolic fit as values arrive
+class p2_quantile {
+public:
+    p2_quantile(double p = 0.5) : p(p), count(0) {
+        double dn_[5] = { 0, p / 2, p, (1 + p) / 2, 1 };
+        double np_[5] = { 1, 1 + 2 * p, 1 + 4 * p, 3 + 2 * p, 5 };
+        for(int i=0; i<5; i++){
+            dn[i] = dn_[i];
+            np[i] = np_[i];
+            n[i] = i + 1;
+        }
+    }
+
+    void add(double x){
+        if(count < 5){
+            // keep the first five values sorted: they are the initial markers
+            int i = int(count++);
+            while(i > 0 && q[i-1] > x){
+                q[i] = q[i-1];
+                i--;
+            }
+            q[i] = x;
+            return;
+        }
+
+        count++;
+
+        int k;
+        if(x < q[0]){
+            q[0] = x;
+            k = 0;
+        }
+        else if(x >= q[4]){
+            q[4] = x;
+            k = 3;
+        }
+        else {
+            k = 0;
+            while(x >= q[k+1]){
+                k++;
+            }
+        }
+
+        for(int i=k+1; i<5; i++){
+            n[i]++;
+        }
+        for(int i=0; i<5; i++){
+            np[i] += dn[i];
+        }
+
+        for(int i=1; i<4; i++){
+            double d = np[i] - n[i];
+
+            if((d >= 1 && n[i+1] - n[i] > 1) || (d <= -1 && n[i-1] - n[i] < -1)){
+                int s = (d > 0) ? 1 : -1;
+                double qp = parabolic(i, s);
+
+                if(q[i-1] < qp && qp < q[i+1]){
+                    q[i] = qp;
+                }
+                else {
+                    q[i] += s * (q[i+s] - q[i]) / (n[i+s] - n[i]);
+                }
+                n[i] += s;
+            }
+        }
+    }
+
+    double value() const {
+        if(count == 0){
+            return NAN;
+        }
+        else if(count < 5){
+            // too few values for the markers yet, so use the order statistics
+            const int m = int(count);
+            return q[std::min(m - 1, int(p * m))];
+        }
+        return q[2];
+    }
+
+private:
+    double parabolic(int i, int s) const {
+        return q[i] + s / (n[i+1] - n[i-1]) *
+               ((n[i] - n[i-1] + s) * (q[i+1] - q[i]) / (n[i+1] - n[i]) +
+                (n[i+1] - n[i] - s) * (q[i] - q[i-1]) / (n[i] - n[i-1]));
+    }
+
+    double p;
+    long count;
+    double q[5], n[5], np[5], dn[5];
+};
+
+// receives every draw of a chain of 'dim' values, keeping running means,
+// variances (Welford) and quantiles of all draws, and writing every thin'th
+// draw to 'filename' (if given) through a buffer of 'chunk' rows. Memory use
+// is fixed, however many draws there are
+class chain_sink {
+public:
+    chain_sink(int dim, long thin = 1, const std::string &filename = "", size_t chunk = 65536,
+               const std::vector<double> &probs = { 0.025, 0.25, 0.5, 0.75, 0.975 })
+        : dim(dim), thin(std::max(1L, thin)), chunk(std::max<size_t>(1, chunk)), probs(probs),
+          ndraws(0), nkept(0), file(nullptr), means(dim, 0.0), sumsqs(dim, 0.0) {
+        for(int j=0; j<dim; j++){
+            for(double p : probs){
+                sketches.push_back(p2_quantile(p));
+            }
+        }
+
+        if(!filename.empty()){
+            file = std::fopen(filename.c_str(), "wb");
+            if(file == nullptr){
+                throw std::runtime_error("could not open " + filename + " for writing");
+            }
+            buffer.reserve(this->chunk * dim);
+            write_header();
+        }
+    }
+
+    // a failed write can't be thrown from here, so call close() first to
+    // find out whether the file is complete
+    ~chain_sink(){
+        try {
+            close();
+        }
+        catch(...) {
+        }
+    }
+
+    chain_sink(const chain_sink&) = delete;
+    chain_sink& operator=(const chain_sink&) = delete;
+
+    void push(const double *x){
+        ndraws++;
+
+        for(int j=0; j<dim; j++){
+            double d = x[j] - means[j];
+            means[j] += d / ndraws;
+            sumsqs[j] += d * (x[j] - means[j]);
+
+            for(size_t i=0; i<probs.size(); i++){
+                sketches[j * probs.size() + i].add(x[j]);
+            }
+        }
+
+        if(ndraws % thin == 0){
+            nkept++;
+
+            if(file != nullptr){
+                buffer.insert(buffer.end(), x, x + dim);
+                if(buffer.size() == chunk * dim){
+                    flush();
+                }
+            }
+        }
+    }
+
+    void push(double x){
+        push(&x);
+    }
+
+    // write out buffered rows and update the sample count in the header
+    void flush(){
+        if(file == nullptr){
+            return;
+        }
+
+        if(!buffer.empty()){
+            std::fseek(file, 0, SEEK_END);
+            if(std::fwrite(buffer.data(), sizeof(double), buffer.size(), file) != buffer.size()){
+                throw std::runtime_error("failed writing the chain file");
+            }
+            buffer.clear();
+        }
+
+        write_header();
+    }
+
+    // flush and close the file; it is closed even if the flush fails
+    void close(){
+        if(file == nullptr){
+            return;
+        }
+
+        try {
+            flush();
+        }
+        catch(...) {
+            std::fclose(file);
+            file = nullptr;
+            throw;
+        }
+
+        std::fclose(file);
+        file = nullptr;
+    }
+
+    long draws() const { return ndraws; }
+    long kept() const { return nkept; }
+    double mean(int j) const { return means[j]; }
+    double variance(int j) const { return (ndraws > 1) ? sumsqs[j] / (ndraws - 1) : NAN; }
+    double quantile(int j, size_t i) const { return sketches[j * probs.size() + i].value(); }
+    const std::vector<double>& quantile_probs() const { return probs; }
+
+private:
+    void write_header(){
+        chain_header h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, "MHCHAIN1", 8);
+        h.dim = dim;
+        h.nsamples = (nkept - buffer.size() / dim);
+        h.thin = thin;
+
+        std::fseek(file, 0, SEEK_SET);
+        std::fwrite(&h, sizeof(h), 1, file);
+        std::fflush(file);
+    }
+
+    int dim;
+    long thin;
+    size_t chunk;
+    std::vector<double> probs;
+    long ndraws, nkept;
+    FILE *file;
+    std::vector<double> buffer;
+    std::vector<double> means, sumsqs;
+    std::vector<p2_quantile> sketches;
+};
+
+// read-only view of a chain file, mapped into memory so that only the rows
+// actually used are read from disk
+class chain_file {
+public:
+    chain_file(const std::string &filename) : base(nullptr), length(0) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd < 0){
+            throw std::runtime_error("could not open " + filename);
+        }
+
+        struct stat st;
+        fstat(fd, &st);
+        length = st.st_size;
+
+        if(length < sizeof(chain_header)){
+            ::close(fd);
+            throw std::runtime_error(filename + " is not a chain file");
+        }
+
+        base = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if(base == MAP_FAILED){
+            base = nullptr;
+            throw std::runtime_error("could not map " + filename);
+        }
+
+        if(std::memcmp(header().magic, "MHCHAIN1", 8) != 0){
+            munmap(base, length);
+            base = nullptr;
+            throw std::runtime_error(filename + " is not a chain file");
+        }
+    }
+
+    ~chain_file(){
+        if(base != nullptr){
+            munmap(base, length);
+        }
+    }
+
+    chain_file(const chain_file&) = delete;
+    chain_file& operator=(const chain_file&) = delete;
+
+    const chain_header& header() const {
+        return *static_cast<const chain_header*>(base);
+    }
+
+    int dim() const { return header().dim; }
+
+    // rows completely on disk (a file still being written may be ahead of its header)
+    long size() const {
+        long on_disk = (length - sizeof(chain_header)) / (sizeof(double) * dim());
+        return std::min<long>(on_disk, header().nsamples);
+    }
+
+    const double* row(long i) const {
+        return reinterpret_cast<const double*>(static_cast<const char*>(base) + sizeof(chain_header))
+               + i * dim();
+    }
+
+private:
+    void *base;
+    size_t length;
+};
+
+// run n iterations of random-walk MH, passing each draw to 'sink'; as
+// metropolis, but nothing is stored here
+template <class LOGDENS, class RNG>
+void metropolis_stream(LOGDENS &&logdens, double init, long n, double scale, RNG &rng,
+                       chain_sink &sink){
+    const double sd = std::sqrt(scale);
+
+    double current = init;
+    double current_ld = logdens(current);
+
+    if(n > 0){
+        sink.push(current);
+    }
+
+    for(long i=1; i<n; i++){
+        step(logdens, sd, rng, current, current_ld);
+        sink.push(current);
+    }
+
+    sink.flush();
+}
+
+}
+
+#endif
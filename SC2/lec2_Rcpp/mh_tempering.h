@@ -0,0 +1,197 @@
+#ifndef mh_tempering_h
+#define mh_tempering_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include "mh.h"
+#include "rng.h"
+
+namespace mh {
+
+struct tempering_result {
+    std::vector<double> samples;        // the chain at temperature 1
+    std::vector<double> betas;          // final inverse temperatures, coldest first
+    std::vector<double> swap_accept;    // between levels i and i+1 (after adaptation)
+    std::vector<double> accept;         // MH acceptance at each level
+    long round_trips;                   // replicas that went coldest -> hottest -> coldest
+};
+
+// parallel tempering (replica exchange) for a thread-safe log-density
+// logdens(x, rng). Replica k targets p(x)^beta and runs on its own worker
+// with its own stream philox(seed, k), taking 'swap_every' MH steps (with
+// proposal variance scale/beta) between swap rounds. A swap round proposes
+// exchanges between neighbouring levels, alternating even and odd pairs so
+// the pairs in a round are disjoint; a swap exchanges the replicas' levels,
+// not their states, so it costs O(1) and no replica waits on a lock.
+//
+// For the first 'adapt' rounds the ladder adapts so that every pair swaps at
+// the same rate: the gaps log(T[i+1] - T[i]) (with T = 1/beta) move by
+// round^-0.6 * (rate[i] - mean rate), as in Miasojedow, Moulines and Vihola
+// (JCGS 2013) but keeping the hottest temperature fixed, so the ladder
+// can't drift off to huge temperatures when a target is easy
+template <class LOGDENS>
+tempering_result parallel_tempering(LOGDENS logdens, double init, long n, double scale,
+                                    std::vector<double> betas, int swap_every, long adapt,
+                                    uint64_t seed){
+    const int ntemps = betas.size();
+    const double tmax = 1.0 / betas.back();
+
+    std::vector<rng::philox> rngs;
+    for(int k=0; k<=ntemps; k++){
+        rngs.emplace_back(seed, k);    // stream ntemps is for the swaps
+    }
+    rng::philox &swap_rng = rngs[ntemps];
+
+    // replica k is at level level_of[k]; replica_at[i] is the replica at level i
+    std::vector<int> level_of(ntemps), replica_at(ntemps);
+    std::vector<double> x(ntemps, init), ld(ntemps);
+    std::vector<long> accepted(ntemps, 0), steps(ntemps, 0);
+
+    // round-trip tracking: +1 once a replica has been hottest, then counts on reaching coldest
+    std::vector<int> direction(ntemps, 0);
+
+    for(int k=0; k<ntemps; k++){
+        level_of[k] = replica_at[k] = k;
+    }
+
+    tbb::parallel_for(0, ntemps, [&](int k){
+        ld[k] = logdens(x[k], rngs[k]);
+    });
+
+    // log gaps between neighbouring temperatures T = 1/beta
+    std::vector<double> rho(std::max(0, ntemps - 1));
+    for(int i=0; i+1<ntemps; i++){
+        rho[i] = std::log(1.0 / betas[i+1] - 1.0 / betas[i]);
+    }
+
+    std::vector<long> swaps_tried(std::max(0, ntemps - 1), 0), swaps_made(std::max(0, ntemps - 1), 0);
+
+    // running swap rate of each pair during adaptation
+    std::vector<double> rate(std::max(0, ntemps - 1), 0.5);
+
+    tempering_result result;
+    result.samples.resize(std::max(0L, n));
+    result.round_trips = 0;
+
+    if(n > 0){
+        result.samples[0] = init;
+    }
+
+    long done = 1;
+
+    for(long round=1; done < n; round++){
+        const long m = std::min<long>(swap_every, n - done);
+
+        tbb::parallel_for(tbb::blocked_range<int>(0, ntemps, 1), [&](tbb::blocked_range<int> r){
+            for(int k=r.begin(); k<r.end(); k++){
+                const int level = level_of[k];
+                const double beta = betas[level];
+                const double sd = std::sqrt(scale / beta);
+
+                // step on the tempered density, but keep ld[k] untempered for the swaps
+                double tld = beta * ld[k];
+                auto tempered = [&](double y){ return beta * logdens(y, rngs[k]); };
+
+                for(long i=0; i<m; i++){
+                    double before = x[k];
+                    step(tempered, sd, rngs[k], x[k], tld);
+
+                    if(x[k] != before){
+                        accepted[level]++;
+                    }
+
+                    if(level == 0){
+                        result.samples[done + i] = x[k];
+                    }
+                }
+
+                steps[level] += m;
+                ld[k] = tld / beta;
+            }
+        });
+
+        done += m;
+
+        // swaps between levels (i, i+1), for even i on even rounds and odd i on odd rounds
+        for(int i=round % 2; i+1<ntemps; i+=2){
+            const int a = replica_at[i];
+            const int b = replica_at[i+1];
+
+            const double log_alpha = (betas[i] - betas[i+1]) * (ld[b] - ld[a]);
+            const bool swap = std::log(swap_rng.uniform()) < log_alpha;
+
+            if(swap){
+                replica_at[i] = b;
+                replica_at[i+1] = a;
+                level_of[a] = i + 1;
+                level_of[b] = i;
+            }
+
+            if(round > adapt){
+                swaps_tried[i]++;
+                swaps_made[i] += swap;
+            }
+            else {
+                const double alpha = std::min(1.0, std::exp(log_alpha));
+                rate[i] += 0.05 * (alpha - rate[i]);
+            }
+        }
+
+        if(round <= adapt && ntemps > 2){
+            double mean_rate = 0;
+            for(double r : rate){
+                mean_rate += r;
+            }
+            mean_rate /= rate.size();
+
+            // a pair that swaps less than average gets a smaller gap
+            double total = 0;
+            for(int i=round % 2; i+1<ntemps; i+=2){
+                rho[i] += std::pow(double(round), -0.6) * (rate[i] - mean_rate);
+            }
+            for(double r : rho){
+                total += std::exp(r);
+            }
+
+            // rescale so the hottest temperature stays at tmax
+            double t = 1.0;
+            for(int i=0; i+1<ntemps; i++){
+                rho[i] += std::log((tmax - 1.0) / total);
+                t += std::exp(rho[i]);
+                betas[i+1] = 1.0 / t;
+            }
+        }
+
+        for(int k=0; k<ntemps; k++){
+            if(level_of[k] == ntemps - 1){
+                direction[k] = 1;
+            }
+            else if(level_of[k] == 0 && direction[k] == 1){
+                direction[k] = 0;
+                result.round_trips++;
+            }
+        }
+    }
+
+    result.betas = betas;
+
+    for(int i=0; i+1<ntemps; i++){
+        result.swap_accept.push_back(swaps_tried[i] > 0 ? double(swaps_made[i]) / swaps_tried[i] : NAN);
+    }
+
+    for(int i=0; i<ntemps; i++){
+        result.accept.push_back(steps[i] > 0 ? double(accepted[i]) / steps[i] : NAN);
+    }
+
+    return result;
+}
+
+}
+
+#endif
@@ -0,0 +1,307 @@
+#ifndef pf_h
+#define pf_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <tbb/blocked_range.h>
+#include <tbb/concurrent_queue.h>
+#include <tbb/parallel_for.h>
+
+#include "rng.h"
+#include "simd_math.h"
+
+// bootstrap particle filter for the noisy Ricker model
+//
+//     log N[t+1] = log r + log N[t] - N[t] + e[t],    e[t] ~ N(0, sig_proc^2)
+//     y[t] = N[t] * exp(u[t]),                        u[t] ~ N(0, sig_obs^2)
+//
+// with N started uniform on (0, 10) and run for nburn + 1 steps before the
+// first observation, as in rickerSimul_Rcpp. The estimate of the likelihood
+// is unbiased, so it can be used as a pseudo-marginal target by mh::step
+// (which keeps the estimate of the current state rather than recomputing it).
+//
+// The particles are stored one array per quantity (log N, log weight, ...)
+// and processed in chunks of chunk_size: each chunk is a task for TBB, with
+// its own Philox stream for each time step, so the estimate depends only on
+// the seed and not on the number of threads. Within a chunk the loops
+// vectorise and exp, log and sin come from simd_math.h
+namespace pf {
+
+const int chunk_size = 1024;
+
+enum resampling { systematic, stratified };
+
+struct settings {
+    int nparticles = 1000;
+    int nburn = 100;
+    double sig_proc = 0.3;
+    double sig_obs = 0.1;
+    double ess_threshold = 0.5;    // resample when the ESS falls below this fraction of nparticles
+    resampling scheme = systematic;
+};
+
+// filter statistics from the last evaluation
+struct stats {
+    int resamples = 0;
+    double mean_ess = 0;           // average ESS over the observations
+};
+
+// the particle arrays, reused between evaluations
+struct workspace {
+    std::vector<double> x, x_new;  // log N
+    std::vector<double> lw;        // log weights
+    std::vector<double> w;         // exp(lw - max), then their cumulative sums
+    std::vector<double> part_max, part_sum, part_sum2;    // per chunk
+
+    void resize(int n){
+        const int nchunks = (n + chunk_size - 1) / chunk_size;
+        x.resize(n);
+        x_new.resize(n);
+        lw.resize(n);
+        w.resize(n);
+        part_max.resize(nchunks);
+        part_sum.resize(nchunks);
+        part_sum2.resize(nchunks);
+    }
+};
+
+// n standard normals (n even, at most 2 * chunk_size) by Box-Muller, with
+// the logs and sines of the whole batch done by simd_math. The uniforms
+// have 32 bits (one Philox word each rather than two), which is plenty
+// for the noise of a particle filter, and the words are generated in bulk
+inline void fill_normal(rng::philox &g, double *z, int n){
+    double a[chunk_size], b[chunk_size];
+    uint32_t u[chunk_size + 4];
+    const int half = n / 2;
+    const double scale = 1.0 / 4294967296.0;
+
+    g.fill(u, (n + 3) / 4 * 4);
+
+    for(int i=0; i<half; i++){
+        a[i] = (u[i] + 0.5) * scale;    // in (0,1), so the log is finite
+        b[i] = 6.283185307179586 * scale * u[half + i];
+    }
+
+    sm_log(a, a, half);
+    for(int i=0; i<half; i++){
+        a[i] = std::sqrt(-2.0 * a[i]);
+    }
+
+    sm_sin(b, z, half);
+    for(int i=0; i<half; i++){
+        b[i] += 1.5707963267948966;    // cos(t) = sin(t + pi/2)
+    }
+    sm_sin(b, z + half, half);
+
+    for(int i=0; i<half; i++){
+        z[i] *= a[i];
+        z[half + i] *= a[i];
+    }
+}
+
+// stream ids: what the numbers are for, the time step and the chunk
+inline uint64_t stream_id(int kind, int t, int chunk){
+    return (uint64_t(kind) << 60) | (uint64_t(t) << 32) | uint64_t(chunk);
+}
+
+// log of the likelihood estimate for log r = logr of the observations y
+// (all positive), using the particles in ws and random numbers from 'seed'
+inline double ricker_loglik(const std::vector<double> &y, double logr, const settings &opts,
+                            uint64_t seed, workspace &ws, stats *st = nullptr){
+    const int N = opts.nparticles;
+    const int nchunks = (N + chunk_size - 1) / chunk_size;
+    const int nsteps = opts.nburn + int(y.size());
+    const double sp = opts.sig_proc;
+    const double so = opts.sig_obs;
+    const double log_sqrt_2pi = 0.918938533204672741780329736406;
+
+    ws.resize(N);
+
+    // run f(chunk, first, last) for every chunk, in parallel
+    auto for_chunks = [&](auto f){
+        tbb::parallel_for(tbb::blocked_range<int>(0, nchunks, 1), [&](tbb::blocked_range<int> r){
+            for(int c=r.begin(); c<r.end(); c++){
+                f(c, c * chunk_size, std::min(N, (c + 1) * chunk_size));
+            }
+        });
+    };
+
+    for_chunks([&](int c, int first, int last){
+        rng::philox g(seed, stream_id(0, 0, c));
+        for(int i=first; i<last; i++){
+            ws.x[i] = std::log(10.0 * (1.0 - g.uniform()));
+            ws.lw[i] = 0;
+        }
+    });
+
+    double loglik = 0;
+    double lse_prev = std::log(double(N));    // log sum of the weights before reweighting
+    double sum_ess = 0;
+    int resamples = 0;
+
+    for(int t=0; t<nsteps; t++){
+        // propagate
+        for_chunks([&](int c, int first, int last){
+            rng::philox g(seed, stream_id(1, t, c));
+            double e[chunk_size], z[chunk_size + 1];
+            const int n = last - first;
+            double *x = &ws.x[first];
+
+            fill_normal(g, z, n + (n % 2));
+
+            for(int i=0; i<n; i++){
+                e[i] = x[i];
+            }
+            sm_exp(e, e, n);
+            for(int i=0; i<n; i++){
+                x[i] = logr + x[i] - e[i] + sp * z[i];
+            }
+        });
+
+        const int k = t - opts.nburn;
+        if(k < 0){
+            continue;
+        }
+
+        // weight by the log-normal observation density, and find the largest log weight
+        const double logy = std::log(y[k]);
+        const double lconst = -std::log(so) - log_sqrt_2pi - logy;
+
+        for_chunks([&](int c, int first, int last){
+            double m = -INFINITY;
+            for(int i=first; i<last; i++){
+                double d = (logy - ws.x[i]) / so;
+                ws.lw[i] += lconst - 0.5 * d * d;
+                m = std::max(m, ws.lw[i]);
+            }
+            ws.part_max[c] = m;
+        });
+
+        const double lmax = *std::max_element(ws.part_max.begin(), ws.part_max.end());
+        if(!std::isfinite(lmax)){
+            return -INFINITY;
+        }
+
+        // log-sum-exp, and the sums needed for the ESS
+        for_chunks([&](int c, int first, int last){
+            double *w = &ws.w[first];
+            const int n = last - first;
+            for(int i=0; i<n; i++){
+                w[i] = ws.lw[first + i] - lmax;
+            }
+            sm_exp(w, w, n);
+
+            double s = 0, s2 = 0;
+            for(int i=0; i<n; i++){
+                s += w[i];
+                s2 += w[i] * w[i];
+            }
+            ws.part_sum[c] = s;
+            ws.part_sum2[c] = s2;
+        });
+
+        // summed in chunk order, so the result doesn't depend on the scheduling
+        double total = 0, total2 = 0;
+        for(int c=0; c<nchunks; c++){
+            total += ws.part_sum[c];
+            total2 += ws.part_sum2[c];
+        }
+
+        const double lse = lmax + std::log(total);
+        loglik += lse - lse_prev;
+        lse_prev = lse;
+
+        const double ess = total * total / total2;
+        sum_ess += ess;
+
+        if(ess >= opts.ess_threshold * N){
+            continue;
+        }
+
+        // resample: cumulative weights (each chunk offset by the sums of
+        // the chunks before it), then each chunk of the output finds its
+        // first ancestor by binary search and walks forward from there
+        std::vector<double> &cum = ws.w;
+        double offset = 0;
+        for(int c=0; c<nchunks; c++){
+            double s = ws.part_sum[c];
+            ws.part_sum[c] = offset;
+            offset += s;
+        }
+
+        for_chunks([&](int c, int first, int last){
+            double s = ws.part_sum[c];
+            for(int i=first; i<last; i++){
+                s += cum[i];
+                cum[i] = s;
+            }
+        });
+
+        const double step = total / N;
+        const double u0 = rng::philox(seed, stream_id(2, t, 0)).uniform();
+
+        for_chunks([&](int c, int first, int last){
+            rng::philox g(seed, stream_id(3, t, c));
+
+            auto point = [&](int j){
+                double u = (opts.scheme == systematic) ? u0 : g.uniform();
+                return (j + u) * step;
+            };
+
+            double u = point(first);
+            int a = std::upper_bound(cum.begin(), cum.end(), u) - cum.begin();
+
+            for(int j=first; j<last; j++){
+                if(j > first){
+                    u = point(j);
+                }
+                while(a < N - 1 && cum[a] <= u){
+                    a++;
+                }
+                ws.x_new[j] = ws.x[std::min(a, N - 1)];
+                ws.lw[j] = 0;
+            }
+        });
+
+        ws.x.swap(ws.x_new);
+        lse_prev = std::log(double(N));
+        resamples++;
+    }
+
+    if(st){
+        st->resamples = resamples;
+        st->mean_ess = y.empty() ? NAN : sum_ess / y.size();
+    }
+
+    return loglik;
+}
+
+// workspaces for concurrent evaluations (e.g. one per chain of
+// metrop_parallel). A workspace is taken from the pool for the length of an
+// evaluation rather than kept per thread: a thread waiting for its TBB
+// tasks may run another chain's evaluation in the meantime
+class workspace_pool {
+public:
+    std::unique_ptr<workspace> acquire(){
+        std::unique_ptr<workspace> ws;
+        if(!pool.try_pop(ws)){
+            ws.reset(new workspace());
+        }
+        return ws;
+    }
+
+    void release(std::unique_ptr<workspace> ws){
+        pool.push(std::move(ws));
+    }
+
+private:
+    tbb::concurrent_queue<std::unique_ptr<workspace>> pool;
+};
+
+}
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef ricker_h
+#define ricker_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include "rng.h"
+#include "simd_math.h"
+
+namespace ricker {
+
+// trajectories are simulated in blocks of this many, laid out one array per
+// quantity (y[i] is simulation i), so every step is a loop over the block
+// that vectorises and calls sm_exp once instead of nsim times. The block
+// lives on the stack and fits in L1
+const int block_size = 256;
+
+// one step of the Ricker map for each of the nb trajectories in y,
+// using e as workspace
+inline void step_batch(double *y, double *e, int nb, double r){
+    for(int i=0; i<nb; i++){
+        e[i] = -y[i];
+    }
+    sm_exp(e, e, nb);
+    for(int i=0; i<nb; i++){
+        y[i] = r * y[i] * e[i];
+    }
+}
+
+// running mean and sum of squares of the two summary statistics (mean and
+// sd of a trajectory) over simulations, by Welford updates
+struct summaries {
+    double count = 0;
+    double m1 = 0, ss1 = 0;
+    double m2 = 0, ss2 = 0;
+
+    void add(double s1, double s2){
+        count++;
+
+        double d1 = s1 - m1;
+        m1 += d1 / count;
+        ss1 += d1 * (s1 - m1);
+
+        double d2 = s2 - m2;
+        m2 += d2 / count;
+        ss2 += d2 * (s2 - m2);
+    }
+
+    // combine with the summaries of other simulations (Chan et al.)
+    void merge(const summaries &b){
+        if(b.count == 0){
+            return;
+        }
+
+        const double n = count + b.count;
+        const double d1 = b.m1 - m1;
+        const double d2 = b.m2 - m2;
+
+        ss1 += b.ss1 + d1 * d1 * count * b.count / n;
+        ss2 += b.ss2 + d2 * d2 * count * b.count / n;
+        m1 += d1 * b.count / n;
+        m2 += d2 * b.count / n;
+        count = n;
+    }
+
+    double sd1() const { return std::sqrt(ss1 / (count - 1)); }
+    double sd2() const { return std::sqrt(ss2 / (count - 1)); }
+
+    // log N(obs_mean; m1, sd1^2) + log N(obs_sd; m2, sd2^2)
+    double loglik(double obs_mean, double obs_sd) const {
+        const double log_sqrt_2pi = 0.918938533204672741780329736406;
+
+        double z1 = (obs_mean - m1) / sd1();
+        double z2 = (obs_sd - m2) / sd2();
+
+        return -0.5 * (z1 * z1 + z2 * z2) - std::log(sd1()) - std::log(sd2()) - 2.0 * log_sqrt_2pi;
+    }
+};
+
+// simulate nb (<= block_size) trajectories together and add their summaries
+// to 's'. uniform(i) and normal(i) draw the random numbers of simulation i
+// of the block, so the caller decides where they come from
+template <class UNIF, class NORM>
+void simulate_block(double r, int nb, int n, int nburn, double sig,
+                    UNIF uniform, NORM normal, summaries &s){
+    double y[block_size], e[block_size];
+    double m[block_size], ss[block_size];    // running mean and sum of squares of each trajectory
+
+    for(int i=0; i<nb; i++){
+        y[i] = 10.0 * uniform(i);
+        m[i] = 0;
+        ss[i] = 0;
+    }
+
+    // burn-in (nburn + 1 steps, as in rickerSimul_Rcpp)
+    for(int j=0; j<=nburn; j++){
+        step_batch(y, e, nb, r);
+    }
+
+    for(int j=0; j<n; j++){
+        if(j > 0){
+            step_batch(y, e, nb, r);
+        }
+
+        // multiplicative log-normal observation noise
+        for(int i=0; i<nb; i++){
+            e[i] = sig * normal(i);
+        }
+        sm_exp(e, e, nb);
+
+        const double w = 1.0 / (j + 1);
+        for(int i=0; i<nb; i++){
+            double obs = y[i] * e[i];
+            double d = obs - m[i];
+            m[i] += d * w;
+            ss[i] += d * (obs - m[i]);
+        }
+    }
+
+    for(int i=0; i<nb; i++){
+        s.add(m[i], std::sqrt(ss[i] / (n - 1)));
+    }
+}
+
+// the same synthetic log-likelihood as synllk_Rcpp, but in plain C++ with
+// random numbers from 'rng' (normal() and uniform()), so it can run on any
+// thread. The nsim trajectories are advanced together a block at a time
+// (see block_size), and the summaries of each trajectory and across
+// trajectories are accumulated with Welford updates, so nothing is
+// allocated. obs_mean and obs_sd are the mean and sd of the data
+template <class RNG>
+double synllk(double logr, int nsim, double obs_mean, double obs_sd, RNG &rng,
+              int n = 50, int nburn = 100, double sig = 0.1){
+    const double r = std::exp(logr);
+
+    auto uniform = [&](int){ return rng.uniform(); };
+    auto normal = [&](int){ return rng.normal(); };
+
+    summaries s;
+
+    for(int start=0; start<nsim; start+=block_size){
+        simulate_block(r, std::min(block_size, nsim - start), n, nburn, sig, uniform, normal, s);
+    }
+
+    return s.loglik(obs_mean, obs_sd);
+}
+
+// the summaries of nsim simulations at each of the npoints values logr[p],
+// written to out[p]. Every (point, block) pair is a separate task, so a grid
+// keeps all the cores busy even when nsim is small. Simulation i at point p
+// draws from its own stream: philox(seed, i) if 'common' (the same draws at
+// every point), otherwise philox(seed, p * 2^32 + i). The block summaries
+// go to 'work', which is only resized, so a caller evaluating many grids
+// can keep it, and are merged in order, so the results depend only on the
+// seed, not on the number of threads or how the tasks are scheduled
+inline void simulate_grid(const double *logr, int npoints, int nsim, uint64_t seed, bool common,
+                          summaries *out, std::vector<summaries> &work,
+                          int n = 50, int nburn = 100, double sig = 0.1){
+    const int nblocks = (nsim + block_size - 1) / block_size;
+
+    work.assign(size_t(npoints) * nblocks, summaries());
+
+    tbb::parallel_for(tbb::blocked_range<int>(0, npoints * nblocks, 1), [&](tbb::blocked_range<int> range){
+        std::vector<rng::philox> streams;
+        streams.reserve(block_size);
+
+        for(int task=range.begin(); task<range.end(); task++){
+            const int p = task / nblocks;
+            const int start = (task % nblocks) * block_size;
+            const int nb = std::min(block_size, nsim - start);
+            const uint64_t first = common ? 0 : uint64_t(p) << 32;
+
+            streams.clear();
+            for(int i=0; i<nb; i++){
+                streams.emplace_back(seed, first + start + i);
+            }
+
+            simulate_block(std::exp(logr[p]), nb, n, nburn, sig,
+                           [&](int i){ return streams[i].uniform(); },
+                           [&](int i){ return streams[i].normal(); }, work[task]);
+        }
+    });
+
+    for(int p=0; p<npoints; p++){
+        out[p] = summaries();
+        for(int b=0; b<nblocks; b++){
+            out[p].merge(work[size_t(p) * nblocks + b]);
+        }
+    }
+}
+
+// synllk with the blocks of simulations spread over threads (simulate_grid
+// with one point). Simulation i draws from its own stream philox(seed, i),
+// so calling it with the same seed for different logr gives common random
+// numbers, and the estimate is a deterministic function of logr
+inline double synllk_parallel(double logr, int nsim, double obs_mean, double obs_sd, uint64_t seed,
+                              int n = 50, int nburn = 100, double sig = 0.1){
+    std::vector<summaries> work;
+    summaries s;
+
+    simulate_grid(&logr, 1, nsim, seed, true, &s, work, n, nburn, sig);
+
+    return s.loglik(obs_mean, obs_sd);
+}
+
+}
+
+#endif
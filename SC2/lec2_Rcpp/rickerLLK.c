@@ -2,6 +2,8 @@
 #include <Rinternals.h>
 #include <Rmath.h>
 
+#include "gauss_llk.h"
+
 SEXP rickerLLK(SEXP observed, SEXP simulated, SEXP sigma){
     double *yobs, *ysim, sig, *lik;
     int n;
@@ -18,10 +20,45 @@ SEXP rickerLLK(SEXP observed, SEXP simulated, SEXP sigma){
     lik = REAL(LLK);
     lik[0] = 0;
     
-    for (int i = 1; i < n; i++){
-        lik[0] = lik[0] + dnorm(log(yobs[i]/ysim[i]), 0, sig, 1);
+    // sum of dnorm(log(yobs[i]/ysim[i]), 0, sig, 1) for i >= 1
+    if(n > 1){
+        lik[0] = gl_lognormal(yobs + 1, ysim + 1, n - 1, sig);
     }
     
     UNPROTECT(1);
     return LLK;
-}
\ No newline at end of file
+}
+
+// rickerLLK for every column of the matrix 'simulated' (one simulated
+// series per column), returning a vector with one log-likelihood per column
+SEXP rickerLLKBatch(SEXP observed, SEXP simulated, SEXP sigma){
+    double *yobs, *ysim, sig, *lik;
+    int n, m;
+
+    SEXP LLK;
+
+    yobs = REAL(observed);
+    ysim = REAL(simulated);
+    sig  = REAL(sigma)[0];
+    n = length(observed);
+
+    if(!isMatrix(simulated) || nrows(simulated) != n){
+        error("simulated must be a matrix with length(observed) rows");
+    }
+    m = ncols(simulated);
+
+    LLK = PROTECT(allocVector(REALSXP, m));
+    lik = REAL(LLK);
+
+    if(n > 1){
+        gl_lognormal_cols(yobs + 1, ysim + 1, n - 1, n, m, sig, lik);
+    }
+    else {
+        for(int j = 0; j < m; j++){
+            lik[j] = 0;
+        }
+    }
+
+    UNPROTECT(1);
+    return LLK;
+}
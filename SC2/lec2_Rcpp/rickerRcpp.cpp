@@ -1,6 +1,15 @@
 #include <Rcpp.h>
+// [[Rcpp::depends(RcppParallel)]]
+#include <RcppParallel.h>
 using namespace Rcpp;
 
+#include "simd_math.h"
+#include "gauss_llk.h"
+#include "mh.h"
+#include "ricker.h"
+#include "pf.h"
+#include "abc.h"
+
 // [[Rcpp::export]]
 NumericVector rickerSimul_Rcpp(const int n, const int nburn, const double r, const double y0){
     // vector to return
@@ -25,25 +34,280 @@ NumericVector rickerSimul_Rcpp(const int n, const int nburn, const double r, con
     return y;
 }
 
+// log-likelihood of yobs under multiplicative log-normal noise with sd sig,
+// for each simulated series in the columns of ysim (gl_lognormal_cols from
+// gauss_llk.h, the kernel rickerLLK uses). As in rickerLLK, the first
+// observation is left out
+// [[Rcpp::export]]
+NumericVector llk_lognormal(const NumericVector yobs, const NumericMatrix ysim, const double sig){
+    const int n = yobs.size();
+
+    if(ysim.nrow() != n){
+        stop("ysim must have length(yobs) rows");
+    }
+
+    NumericVector out(ysim.ncol());
+    if(n > 1){
+        gl_lognormal_cols(yobs.begin() + 1, ysim.begin() + 1, n - 1, n, ysim.ncol(), sig, out.begin());
+    }
+
+    return out;
+}
+
+// draws from R's generator, so set.seed() still works
+struct r_rng {
+    double normal() { return norm_rand(); }
+    double uniform() { return unif_rand(); }
+};
+
+// the nsim trajectories are simulated together by ricker::synllk, which
+// advances them a block at a time with sm_exp and keeps their summaries
+// with Welford updates, so apart from the result nothing is allocated
 // [[Rcpp::export]]
 NumericVector synllk_Rcpp(const double logr, const int nsim, const NumericVector yobs){
-    NumericVector ysim;
-    NumericVector s1(nsim), s2(nsim);
-    NumericVector y0(nsim);
-    NumericVector out;
+    r_rng rng;
+
+    // assume we know sd = 0.1
+    return NumericVector::create(ricker::synllk(logr, nsim, mean(yobs), sd(yobs), rng, 50, 100, 0.1));
+}
+
+// synllk_Rcpp on all cores (ricker::synllk_parallel): simulation i draws
+// from its own Philox stream, so the result doesn't depend on the number of
+// threads. With crn = TRUE the streams come from 'seed', so the same draws
+// are used at every logr and the estimate is a deterministic function of
+// logr (for optim); otherwise a new seed is taken from R's generator
+// [[Rcpp::export]]
+double synllk_parallel(const double logr, const int nsim, const NumericVector yobs,
+                       bool crn = false, double seed = 1){
+    if(!crn){
+        seed = std::floor(unif_rand() * 4294967296.0);
+    }
+
+    return ricker::synllk_parallel(logr, nsim, mean(yobs), sd(yobs), uint64_t(seed));
+}
+
+// synllk_parallel at every value of logr in one call, with all the points
+// and blocks of simulations running in parallel. Returns one row per point:
+// logr, the log-likelihood and the mean and sd across simulations of the two
+// summary statistics. crn and seed are as for synllk_parallel (with
+// crn = TRUE every point uses the same draws)
+// [[Rcpp::export]]
+NumericMatrix synllk_grid(const NumericVector logr, const int nsim, const NumericVector yobs,
+                          bool crn = true, double seed = 1){
+    // block summaries, kept between calls so profiling many grids doesn't reallocate
+    static std::vector<ricker::summaries> work;
+    std::vector<ricker::summaries> s(logr.size());
+
+    if(!crn){
+        seed = std::floor(unif_rand() * 4294967296.0);
+    }
 
-    double r = exp(logr);
+    ricker::simulate_grid(logr.begin(), logr.size(), nsim, uint64_t(seed), crn, s.data(), work);
 
-    y0 = runif(nsim, 0, 10);
-    for(int i=0; i<nsim; i++){
-        // assume we know sd = 0.1
-        ysim = rickerSimul_Rcpp(50, 100, r, y0[i]) * exp(rnorm(50, 0, 0.1));
-        s1[i] = mean(ysim);
-        s2[i] = sd(ysim);
+    const double obs_mean = mean(yobs);
+    const double obs_sd = sd(yobs);
+
+    NumericMatrix out(logr.size(), 6);
+    for(int p=0; p<logr.size(); p++){
+        out(p, 0) = logr[p];
+        out(p, 1) = s[p].loglik(obs_mean, obs_sd);
+        out(p, 2) = s[p].m1;
+        out(p, 3) = s[p].sd1();
+        out(p, 4) = s[p].m2;
+        out(p, 5) = s[p].sd2();
     }
 
-    // add log-likelihoods of our two summary statistics
-    out = R::dnorm(mean(yobs), mean(s1), sd(s1), true) + R::dnorm(sd(yobs), mean(s2), sd(s2), true);
-    
+    colnames(out) = CharacterVector::create("logr", "loglik", "mean_s1", "sd_s1", "mean_s2", "sd_s2");
+
     return out;
-}
\ No newline at end of file
+}
+
+// synthetic log-likelihood as a native target for metrop_Rcpp, so each MH
+// step runs ricker::synllk directly instead of going through an R closure.
+// It is also thread-safe (for metrop_parallel): that version uses the
+// chain's own random number stream instead of R's
+class synllk_target_ : public mh::target {
+public:
+    synllk_target_(int nsim, NumericVector yobs)
+        : nsim(nsim), yobs(yobs), obs_mean(mean(yobs)), obs_sd(sd(yobs)) {}
+
+    double log_density(double logr){
+        r_rng rng;
+        return ricker::synllk(logr, nsim, obs_mean, obs_sd, rng);
+    }
+
+    bool thread_safe() const { return true; }
+
+    double log_density(double logr, rng::philox &rng){
+        return ricker::synllk(logr, nsim, obs_mean, obs_sd, rng);
+    }
+
+private:
+    int nsim;
+    NumericVector yobs;
+    double obs_mean, obs_sd;
+};
+
+// [[Rcpp::export]]
+XPtr<mh::target> synllk_target(const int nsim, const NumericVector yobs){
+    return XPtr<mh::target>(new synllk_target_(nsim, yobs), true);
+}
+
+pf::settings pf_settings(int nparticles, double sig_proc, double sig_obs, int nburn,
+                         std::string resampling, double ess_threshold){
+    if(resampling != "systematic" && resampling != "stratified"){
+        stop("resampling must be \"systematic\" or \"stratified\"");
+    }
+
+    if(nparticles < 1 || nburn < 0){
+        stop("need nparticles >= 1 and nburn >= 0");
+    }
+
+    if(!(sig_obs > 0) || !(sig_proc >= 0)){
+        stop("need sig_obs > 0 and sig_proc >= 0");
+    }
+
+    if(!(ess_threshold >= 0 && ess_threshold <= 1)){
+        stop("ess_threshold must be in [0, 1]");
+    }
+
+    pf::settings opts;
+    opts.nparticles = nparticles;
+    opts.sig_proc = sig_proc;
+    opts.sig_obs = sig_obs;
+    opts.nburn = nburn;
+    opts.scheme = (resampling == "systematic") ? pf::systematic : pf::stratified;
+    opts.ess_threshold = ess_threshold;
+
+    return opts;
+}
+
+// particle filter estimate of the log-likelihood of log r for the noisy
+// Ricker model (pf.h), with process noise sd sig_proc and observation
+// noise sd sig_obs. Resamples (in parallel) when the effective sample size
+// falls below ess_threshold * nparticles
+// [[Rcpp::export]]
+List pf_loglik(const double logr, const NumericVector yobs, int nparticles = 1000,
+               double sig_proc = 0.3, double sig_obs = 0.1, int nburn = 100,
+               std::string resampling = "systematic", double ess_threshold = 0.5, double seed = -1){
+    pf::settings opts = pf_settings(nparticles, sig_proc, sig_obs, nburn, resampling, ess_threshold);
+
+    if(seed < 0){
+        seed = std::floor(unif_rand() * 4294967296.0);
+    }
+
+    pf::workspace ws;
+    pf::stats st;
+    double ll = pf::ricker_loglik(as<std::vector<double>>(yobs), logr, opts, uint64_t(seed), ws, &st);
+
+    return List::create(Named("loglik") = ll,
+                        Named("resamples") = st.resamples,
+                        Named("mean_ess") = st.mean_ess);
+}
+
+// the particle filter as a native target for metrop_Rcpp and
+// metrop_parallel. mh::step keeps the estimate of the current state, so
+// this is a pseudo-marginal sampler: its stationary distribution is the
+// exact posterior of log r, whatever the number of particles
+class pf_target_ : public mh::target {
+public:
+    pf_target_(NumericVector yobs, pf::settings opts)
+        : y(as<std::vector<double>>(yobs)), opts(opts) {}
+
+    double log_density(double logr){
+        uint64_t seed = uint64_t(std::floor(unif_rand() * 4294967296.0));
+        return pf::ricker_loglik(y, logr, opts, seed, ws);
+    }
+
+    bool thread_safe() const { return true; }
+
+    double log_density(double logr, rng::philox &rng){
+        uint64_t seed = (uint64_t(rng.next_u32()) << 32) | rng.next_u32();
+
+        std::unique_ptr<pf::workspace> w = pool.acquire();
+        double ll = pf::ricker_loglik(y, logr, opts, seed, *w);
+        pool.release(std::move(w));
+
+        return ll;
+    }
+
+private:
+    std::vector<double> y;
+    pf::settings opts;
+    pf::workspace ws;
+    pf::workspace_pool pool;
+};
+
+// [[Rcpp::export]]
+XPtr<mh::target> pf_target(const NumericVector yobs, int nparticles = 1000, double sig_proc = 0.3,
+                           double sig_obs = 0.1, int nburn = 100, std::string resampling = "systematic",
+                           double ess_threshold = 0.5){
+    pf::settings opts = pf_settings(nparticles, sig_proc, sig_obs, nburn, resampling, ess_threshold);
+    return XPtr<mh::target>(new pf_target_(yobs, opts), true);
+}
+
+List abc_list(const abc::result &res){
+    return List::create(Named("theta") = wrap(res.pop.theta),
+                        Named("weight") = wrap(res.pop.weight),
+                        Named("distance") = wrap(res.pop.dist),
+                        Named("eps") = wrap(res.eps),
+                        Named("accept") = wrap(res.accept),
+                        Named("simulations") = double(res.simulations),
+                        Named("steps_per_simulation") = double(res.steps) / res.simulations,
+                        Named("stalled") = res.stalled);
+}
+
+abc::settings abc_settings(const double lower, const double upper, const int nburn, const double sig){
+    if(!(lower < upper) || nburn < 0){
+        stop("need lower < upper and nburn >= 0");
+    }
+
+    abc::settings opts;
+    opts.lower = lower;
+    opts.upper = upper;
+    opts.nburn = nburn;
+    opts.sig = sig;
+    return opts;
+}
+
+// rejection ABC for log r (abc.h): nprop draws from a uniform prior on
+// (lower, upper), keeping those whose simulated series is within 'eps' of
+// yobs (root mean square difference of the logs)
+// [[Rcpp::export]]
+List abc_rejection(const NumericVector yobs, double nprop, const double eps, const double lower = 0,
+                   const double upper = 5, const int nburn = 100, const double sig = 0.1, double seed = -1){
+    if(seed < 0){
+        seed = std::floor(unif_rand() * 4294967296.0);
+    }
+
+    std::vector<double> logy(yobs.size());
+    std::transform(yobs.begin(), yobs.end(), logy.begin(), [](double y){ return std::log(y); });
+
+    return abc_list(abc::rejection(logy, long(nprop), eps, abc_settings(lower, upper, nburn, sig), uint64_t(seed)));
+}
+
+// SMC-ABC for log r (abc.h) with nparticles particles, each generation's
+// tolerance being the 'alpha' quantile of the last one's distances
+// [[Rcpp::export]]
+List abc_smc(const NumericVector yobs, const int nparticles = 1000, const double alpha = 0.5,
+             const double eps_min = 0, const int max_generations = 20, const double min_accept = 0.01,
+             double max_attempts = 1e6, const double lower = 0, const double upper = 5,
+             const int nburn = 100, const double sig = 0.1, double seed = -1){
+    if(nparticles < 1 || max_generations < 1 || max_attempts < 1){
+        stop("nparticles, max_generations and max_attempts must be at least 1");
+    }
+
+    if(!(alpha > 0 && alpha < 1)){
+        stop("alpha must be in (0, 1)");
+    }
+
+    if(seed < 0){
+        seed = std::floor(unif_rand() * 4294967296.0);
+    }
+
+    std::vector<double> logy(yobs.size());
+    std::transform(yobs.begin(), yobs.end(), logy.begin(), [](double y){ return std::log(y); });
+
+    return abc_list(abc::smc(logy, nparticles, alpha, eps_min, max_generations, min_accept, long(max_attempts),
+                             abc_settings(lower, upper, nburn, sig), uint64_t(seed)));
+}
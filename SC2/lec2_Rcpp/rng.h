@@ -0,0 +1,149 @@
+#ifndef rng_h
+#define rng_h
+
+#include <cmath>
+#include <cstdint>
+
+namespace rng {
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3", SC'11). Each (seed, stream) pair gives an
+// independent sequence, so every chain or thread can have its own stream
+// without sharing state: R's generator is not thread-safe
+class philox {
+public:
+    philox(uint64_t seed, uint64_t stream) : block(0), pos(4), has_spare(false), spare(0) {
+        key[0] = uint32_t(seed);
+        key[1] = uint32_t(seed >> 32);
+        ctr[2] = uint32_t(stream);
+        ctr[3] = uint32_t(stream >> 32);
+    }
+
+    // the 4 words of block 'n' of this stream
+    void generate(uint64_t n, uint32_t out[4]) const {
+        uint32_t c[4] = { uint32_t(n), uint32_t(n >> 32), ctr[2], ctr[3] };
+        uint32_t k[2] = { key[0], key[1] };
+
+        for(int round=0; round<10; round++){
+            if(round > 0){
+                k[0] += 0x9E3779B9;
+                k[1] += 0xBB67AE85;
+            }
+
+            uint64_t p0 = uint64_t(0xD2511F53) * c[0];
+            uint64_t p1 = uint64_t(0xCD9E8D57) * c[2];
+
+            uint32_t next[4] = { uint32_t(p1 >> 32) ^ c[1] ^ k[0], uint32_t(p1),
+                                 uint32_t(p0 >> 32) ^ c[3] ^ k[1], uint32_t(p0) };
+
+            c[0] = next[0]; c[1] = next[1]; c[2] = next[2]; c[3] = next[3];
+        }
+
+        out[0] = c[0]; out[1] = c[1]; out[2] = c[2]; out[3] = c[3];
+    }
+
+    // the next n words (n a multiple of 4), starting at the next block
+    // boundary. The blocks are computed side by side, so the rounds
+    // vectorise: much faster than n calls to next_u32 for large n
+    void fill(uint32_t *out, int n) {
+        const int nblocks = n / 4;
+        const int width = 64;
+
+        for(int start=0; start<nblocks; start+=width){
+            const int m = (nblocks - start < width) ? nblocks - start : width;
+            uint32_t c0[width], c1[width], c2[width], c3[width];
+
+            for(int i=0; i<m; i++){
+                uint64_t b = block + start + i;
+                c0[i] = uint32_t(b);
+                c1[i] = uint32_t(b >> 32);
+                c2[i] = ctr[2];
+                c3[i] = ctr[3];
+            }
+
+            uint32_t k0 = key[0], k1 = key[1];
+
+            for(int round=0; round<10; round++){
+                if(round > 0){
+                    k0 += 0x9E3779B9;
+                    k1 += 0xBB67AE85;
+                }
+
+                for(int i=0; i<m; i++){
+                    uint64_t p0 = uint64_t(0xD2511F53) * c0[i];
+                    uint64_t p1 = uint64_t(0xCD9E8D57) * c2[i];
+
+                    uint32_t n0 = uint32_t(p1 >> 32) ^ c1[i] ^ k0;
+                    uint32_t n2 = uint32_t(p0 >> 32) ^ c3[i] ^ k1;
+
+                    c0[i] = n0;
+                    c1[i] = uint32_t(p1);
+                    c2[i] = n2;
+                    c3[i] = uint32_t(p0);
+                }
+            }
+
+            for(int i=0; i<m; i++){
+                uint32_t *o = out + 4 * (start + i);
+                o[0] = c0[i]; o[1] = c1[i]; o[2] = c2[i]; o[3] = c3[i];
+            }
+        }
+
+        block += nblocks;
+        pos = 4;
+    }
+
+    uint32_t next_u32() {
+        if(pos == 4){
+            generate(block++, buf);
+            pos = 0;
+        }
+        return buf[pos++];
+    }
+
+    // uniform on [0,1) with 53 random bits
+    double uniform() {
+        uint64_t a = next_u32() >> 5;
+        uint64_t b = next_u32() >> 6;
+        return (a * 67108864.0 + b) * (1.0 / 9007199254740992.0);
+    }
+
+    // standard normal by Box-Muller, keeping the second value for the next call
+    double normal() {
+        if(has_spare){
+            has_spare = false;
+            return spare;
+        }
+
+        double u1 = 1.0 - uniform();    // (0,1], so the log is finite
+        double u2 = uniform();
+
+        double r = std::sqrt(-2.0 * std::log(u1));
+        double theta = 6.283185307179586 * u2;
+
+        spare = r * std::sin(theta);
+        has_spare = true;
+
+        return r * std::cos(theta);
+    }
+
+    // move to the start of block n (4 words per block)
+    void seek(uint64_t n) {
+        block = n;
+        pos = 4;
+        has_spare = false;
+    }
+
+private:
+    uint32_t key[2];
+    uint32_t ctr[4];
+    uint64_t block;
+    uint32_t buf[4];
+    int pos;
+    bool has_spare;
+    double spare;
+};
+
+}
+
+#endif
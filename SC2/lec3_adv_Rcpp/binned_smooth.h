@@ -0,0 +1,173 @@
+#ifndef binned_smooth_h
+#define binned_smooth_h
+
+// include RcppArmadillo.h first when using this from R
+#ifndef ARMA_INCLUDES
+#include <armadillo>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "local_cv.h"
+
+namespace lmlocal {
+
+// regular m1 x m2 grid over the range of the two columns of x
+class grid2 {
+public:
+    grid2(const arma::mat &x, arma::uword m1, arma::uword m2) {
+        m[0] = m1;
+        m[1] = m2;
+        for(int k=0; k<2; k++){
+            lo[k] = x.col(k).min();
+            double range = x.col(k).max() - lo[k];
+            step[k] = (range > 0) ? range / (m[k] - 1) : 1.0;
+        }
+    }
+
+    // the cell (i, j) holding (x1, x2) and the position in it, (f1, f2) in
+    // [0, 1]^2 (points outside the grid go to the nearest cell's edge)
+    void locate(double x1, double x2, arma::uword &i, arma::uword &j, double &f1, double &f2) const {
+        locate(x1, 0, i, f1);
+        locate(x2, 1, j, f2);
+    }
+
+    double node(int k, arma::uword i) const { return lo[k] + i * step[k]; }
+
+    arma::uword m[2];
+    double lo[2], step[2];
+
+private:
+    void locate(double x, int k, arma::uword &i, double &f) const {
+        double u = (x - lo[k]) / step[k];
+        double c = std::min(double(m[k] - 2), std::max(0.0, std::floor(u)));
+        i = arma::uword(c);
+        f = std::min(1.0, std::max(0.0, u - c));
+    }
+};
+
+// local regression of y on X with the Gaussian kernel of bandwidth H over
+// two covariates x (n x 2), approximated on a grid (binning as in Wand,
+// JCGS 1994). Each row's moment products (see local_cv.h) are shared
+// between the four nodes around it by linear binning, and the kernel
+// sums of X^T W X and X^T W y at every node are then convolutions of
+// these fields with the kernel on the grid, done by FFT (zero-padded to
+// twice the grid, so they don't wrap). So the cost is O(n p^2) for the
+// binning plus O(m log m p^2) for the convolutions, whatever H is. The
+// only approximation is moving each row's kernel centre to the nodes
+// around it, an error of O((step / bandwidth)^2).
+//
+// coef(i, j, ) are the local coefficients at node (i, j), NaN where the
+// kernel mass of the data is too small for a fit
+inline arma::cube binned_coefficients(const arma::vec &y, const arma::mat &x, const arma::mat &X,
+                                      const arma::mat &H, const grid2 &grid){
+    const arma::uword n = x.n_rows, p = X.n_cols;
+    const arma::uword m1 = grid.m[0], m2 = grid.m[1];
+
+    // the moment products, and a column of ones for the kernel mass
+    arma::mat P = arma::join_rows(moment_products(X, y), arma::ones<arma::vec>(n));
+    const arma::uword C = P.n_cols;
+
+    arma::cube F(m1, m2, C, arma::fill::zeros);
+
+    std::vector<arma::uword> cell_i(n), cell_j(n);
+    arma::mat frac(n, 2);
+    for(arma::uword r=0; r<n; r++){
+        grid.locate(x(r, 0), x(r, 1), cell_i[r], cell_j[r], frac(r, 0), frac(r, 1));
+    }
+
+    for(arma::uword c=0; c<C; c++){
+        arma::mat &f = F.slice(c);
+        const double *pc = P.colptr(c);
+        for(arma::uword r=0; r<n; r++){
+            const arma::uword i = cell_i[r], j = cell_j[r];
+            const double f1 = frac(r, 0), f2 = frac(r, 1);
+            f.at(i, j) += (1 - f1) * (1 - f2) * pc[r];
+            f.at(i + 1, j) += f1 * (1 - f2) * pc[r];
+            f.at(i, j + 1) += (1 - f1) * f2 * pc[r];
+            f.at(i + 1, j + 1) += f1 * f2 * pc[r];
+        }
+    }
+
+    // the kernel at every offset between nodes, wrapped round the padded grid
+    const arma::uword N1 = 2 * m1, N2 = 2 * m2;
+    const arma::mat Hinv = arma::inv_sympd(H);
+    arma::mat K(N1, N2, arma::fill::zeros);
+
+    for(long a=-long(m1 - 1); a<long(m1); a++){
+        for(long b=-long(m2 - 1); b<long(m2); b++){
+            const double d1 = a * grid.step[0], d2 = b * grid.step[1];
+            const double q = Hinv(0, 0) * d1 * d1 + 2.0 * Hinv(0, 1) * d1 * d2 + Hinv(1, 1) * d2 * d2;
+            K((a + long(N1)) % N1, (b + long(N2)) % N2) = std::exp(-0.5 * q);
+        }
+    }
+
+    const arma::cx_mat Kf = arma::fft2(K);
+
+    for(arma::uword c=0; c<C; c++){
+        arma::mat S = arma::real(arma::ifft2(arma::fft2(F.slice(c), N1, N2) % Kf));
+        F.slice(c) = S.submat(0, 0, m1 - 1, m2 - 1);
+    }
+
+    // the local fits: the FFT's rounding error is relative to the largest
+    // sums, so nodes with too little kernel mass are left out
+    const double min_mass = 1e-10 * F.slice(C - 1).max();
+
+    arma::cube coef(m1, m2, p);
+    arma::mat A;
+    arma::vec b, beta;
+
+    for(arma::uword j=0; j<m2; j++){
+        for(arma::uword i=0; i<m1; i++){
+            unpack_moments(&F(i, j, 0), m1 * m2, p, A, b);
+
+            bool ok = F(i, j, C - 1) > min_mass && solve_scaled(A, b, beta);
+
+            for(arma::uword a=0; a<p; a++){
+                coef(i, j, a) = ok ? beta[a] : NAN;
+            }
+        }
+    }
+
+    return coef;
+}
+
+// fitted values at the rows of x0 (with design X0): the local polynomials
+// of the four nodes around each row, evaluated at the row and interpolated
+// bilinearly
+inline arma::vec binned_predict(const arma::mat &x0, const arma::mat &X0, const arma::cube &coef,
+                                const grid2 &grid){
+    const arma::uword p = X0.n_cols;
+    arma::vec out(x0.n_rows);
+
+    for(arma::uword r=0; r<x0.n_rows; r++){
+        arma::uword i, j;
+        double f1, f2;
+        grid.locate(x0(r, 0), x0(r, 1), i, j, f1, f2);
+
+        const double w[4] = { (1 - f1) * (1 - f2), f1 * (1 - f2), (1 - f1) * f2, f1 * f2 };
+        const arma::uword ni[4] = { i, i + 1, i, i + 1 }, nj[4] = { j, j, j + 1, j + 1 };
+
+        double fit = 0.0;
+        for(int c=0; c<4; c++){
+            if(w[c] == 0.0){
+                continue;
+            }
+            double node_fit = 0.0;
+            for(arma::uword a=0; a<p; a++){
+                node_fit += X0(r, a) * coef(ni[c], nj[c], a);
+            }
+            fit += w[c] * node_fit;
+        }
+
+        out[r] = fit;
+    }
+
+    return out;
+}
+
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef gauss_kernel_h
+#define gauss_kernel_h
+
+// include RcppArmadillo.h first when using this from R
+#ifndef ARMA_INCLUDES
+#include <armadillo>
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+#include "simd_math.h"
+
+namespace lmlocal {
+
+// buffers for one batch of centres, reused between batches
+struct kernel_block {
+    arma::mat K;     // n x (number of centres)
+    arma::mat Zc;    // whitened centres, d x (number of centres)
+};
+
+// Gaussian densities N(c, H) at every row of x, for many centres c at once.
+// With H = L L^T and z = L^-1 x the log-density is
+//
+//     -(|z|^2 + |zc|^2 - 2 z.zc) / 2 - d/2 log(2 pi) - log|L|
+//
+// so the data are whitened once, by one triangular solve (trsm), and the
+// cross terms of a batch of centres are one matrix product (gemm); the rest
+// is a single pass over the result followed by sm_exp. The data are centred
+// before whitening, so the expansion doesn't lose precision when |z| is
+// large compared with the bandwidth
+class gauss_kernel {
+public:
+    gauss_kernel(const arma::mat &x, const arma::mat &L)
+        : L(L), shift(arma::mean(x, 0))
+    {
+        arma::mat xc = x.each_row() - shift;
+        Z = arma::solve(arma::trimatl(L), xc.t()).t();
+        zz = arma::sum(arma::square(Z), 1);
+        lconst = (x.n_cols / 2.0) * std::log(2.0 * M_PI) + arma::sum(arma::log(L.diag()));
+    }
+
+    // blk.K(i, j) = density (or log-density) at row i of x of N(c_j, H),
+    // for the centres c_j = rows [first, last) of 'centres'. blk's buffers
+    // are only reallocated if the batch size changes
+    void eval(const arma::mat &centres, arma::uword first, arma::uword last,
+              kernel_block &blk, bool log = false) const {
+        const arma::uword d = L.n_rows;
+        const arma::uword m = last - first;
+
+        // whiten the centres by forward substitution (m d^2, next to nothing)
+        blk.Zc.set_size(d, m);
+        for(arma::uword j=0; j<m; j++){
+            double *zc = blk.Zc.colptr(j);
+            for(arma::uword r=0; r<d; r++){
+                double acc = 0.0;
+                for(arma::uword k=0; k<r; k++){
+                    acc += zc[k] * L.at(r, k);
+                }
+                zc[r] = (centres.at(first + j, r) - shift[r] - acc) / L.at(r, r);
+            }
+        }
+
+        blk.K = Z * blk.Zc;
+
+        for(arma::uword j=0; j<m; j++){
+            const double *zc = blk.Zc.colptr(j);
+            double cc = 0.0;
+            for(arma::uword r=0; r<d; r++){
+                cc += zc[r] * zc[r];
+            }
+
+            double *k = blk.K.colptr(j);
+            const double *z2 = zz.memptr();
+            for(arma::uword i=0; i<Z.n_rows; i++){
+                k[i] = -0.5 * std::max(0.0, z2[i] + cc - 2.0 * k[i]) - lconst;
+            }
+        }
+
+        if(!log){
+            sm_exp(blk.K.memptr(), blk.K.memptr(), blk.K.n_elem);
+        }
+    }
+
+private:
+    arma::mat L;
+    arma::rowvec shift;
+    arma::mat Z;       // whitened, centred data (n x d)
+    arma::vec zz;      // |z|^2 of each row
+    double lconst;
+};
+
+}
+
+#endif
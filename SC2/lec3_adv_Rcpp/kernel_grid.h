@@ -0,0 +1,185 @@
+#ifndef kernel_grid_h
+#define kernel_grid_h
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace lmlocal {
+
+// uniform grid over the points x (n x d, column-major as in armadillo) after
+// whitening by the bandwidth: with H = L L^T, z = L^-1 x, so the Gaussian
+// kernel exp(-q/2), q = (x - x0)^T H^-1 (x - x0) = |z - z0|^2, is the same
+// in every direction. Points are sorted by cell and their z stored in that
+// order, so the points of a cell are contiguous. Finding the points within
+// 'radius' of z0 (in sds of the kernel) looks at the cells within radius of
+// z0's cell only, which is O(number of neighbours) rather than O(n).
+// x can have at most max_dim columns
+class grid {
+public:
+    static const int max_dim = 16;
+
+    grid(const double *x, int n, int d, const double *L, double radius)
+        : n(n), d(d), radius(radius), L(L, L + d * d), lo(d), ncell(d), stride(d)
+    {
+        std::vector<double> z(size_t(n) * d);
+        std::vector<double> hi(d);
+
+        for(int k=0; k<d; k++){
+            lo[k] = INFINITY;
+            hi[k] = -INFINITY;
+        }
+
+        for(int i=0; i<n; i++){
+            double xi[max_dim], *zi = &z[size_t(i) * d];
+            for(int k=0; k<d; k++){
+                xi[k] = x[i + size_t(k) * n];
+            }
+            whiten(xi, zi);
+            for(int k=0; k<d; k++){
+                lo[k] = std::min(lo[k], zi[k]);
+                hi[k] = std::max(hi[k], zi[k]);
+            }
+        }
+
+        // cells of side 'radius', made larger if that would give many more
+        // cells than points (e.g. a tiny bandwidth)
+        cell = radius;
+        for(;;){
+            double total = 1;
+            for(int k=0; k<d; k++){
+                ncell[k] = int(std::floor((hi[k] - lo[k]) / cell)) + 1;
+                total *= ncell[k];
+            }
+            if(total <= 4.0 * n + 1024){
+                break;
+            }
+            cell *= 2;
+        }
+
+        reach = int(std::ceil(radius / cell));
+
+        int ncells = 1;
+        for(int k=0; k<d; k++){
+            stride[k] = ncells;
+            ncells *= ncell[k];
+        }
+
+        // counting sort of the points by cell
+        std::vector<int> cell_of(n);
+        start.assign(ncells + 1, 0);
+
+        for(int i=0; i<n; i++){
+            int c = 0;
+            for(int k=0; k<d; k++){
+                c += coord(z[size_t(i) * d + k], k) * stride[k];
+            }
+            cell_of[i] = c;
+            start[c + 1]++;
+        }
+
+        for(int c=0; c<ncells; c++){
+            start[c + 1] += start[c];
+        }
+
+        order.resize(n);
+        zs.resize(size_t(n) * d);
+        std::vector<int> next(start.begin(), start.end() - 1);
+
+        for(int i=0; i<n; i++){
+            int pos = next[cell_of[i]]++;
+            order[pos] = i;
+            std::copy(&z[size_t(i) * d], &z[size_t(i) * d] + d, &zs[size_t(pos) * d]);
+        }
+    }
+
+    // z = L^-1 x by forward substitution (as dmvnorm_ does)
+    void whiten(const double *x, double *z) const {
+        for(int r=0; r<d; r++){
+            double acc = 0;
+            for(int k=0; k<r; k++){
+                acc += z[k] * L[r + k * d];
+            }
+            z[r] = (x[r] - acc) / L[r + r * d];
+        }
+    }
+
+    // the points i with q = |z_i - z0|^2 <= radius^2, where z0 is the
+    // whitened x0 (length d): their indices go to idx and their q to q
+    // (both cleared first). Returns the number of points
+    int neighbours(const double *x0, std::vector<int> &idx, std::vector<double> &q) const {
+        double z0[max_dim];
+        int c[max_dim];
+
+        whiten(x0, z0);
+
+        idx.clear();
+        q.clear();
+
+        // the box of cells within 'reach' of z0's cell, clipped to the grid
+        int first[max_dim], last[max_dim];
+        for(int k=0; k<d; k++){
+            int ck = int(std::floor((z0[k] - lo[k]) / cell));
+            first[k] = std::max(0, ck - reach);
+            last[k] = std::min(ncell[k] - 1, ck + reach);
+            if(first[k] > last[k]){
+                return 0;
+            }
+            c[k] = first[k];
+        }
+
+        const double r2 = radius * radius;
+
+        // odometer over the cells of the box
+        for(;;){
+            int cellid = 0;
+            for(int k=0; k<d; k++){
+                cellid += c[k] * stride[k];
+            }
+
+            for(int pos=start[cellid]; pos<start[cellid + 1]; pos++){
+                const double *zi = &zs[size_t(pos) * d];
+                double qi = 0;
+                for(int k=0; k<d; k++){
+                    qi += (zi[k] - z0[k]) * (zi[k] - z0[k]);
+                }
+                if(qi <= r2){
+                    idx.push_back(order[pos]);
+                    q.push_back(qi);
+                }
+            }
+
+            int k = 0;
+            while(k < d && c[k] == last[k]){
+                c[k] = first[k];
+                k++;
+            }
+            if(k == d){
+                break;
+            }
+            c[k]++;
+        }
+
+        return idx.size();
+    }
+
+    int size() const { return n; }
+
+private:
+    int coord(double zk, int k) const {
+        return std::min(ncell[k] - 1, int(std::floor((zk - lo[k]) / cell)));
+    }
+
+    int n, d;
+    double radius, cell;
+    int reach;
+    std::vector<double> L;
+    std::vector<double> lo;
+    std::vector<int> ncell, stride;
+    std::vector<int> start, order;    // points of cell c are order[start[c] .. start[c+1])
+    std::vector<double> zs;           // whitened points, in the same order
+};
+
+}
+
+#endif
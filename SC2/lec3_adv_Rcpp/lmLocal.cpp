@@ -0,0 +1,365 @@
+// [[Rcpp::depends(RcppArmadillo, RcppParallel)]]
+#include <RcppArmadillo.h>
+#include <RcppParallel.h>
+#include <tbb/enumerable_thread_specific.h>
+using namespace arma;
+
+#include <vector>
+
+#include "simd_math.h"
+#include "kernel_grid.h"
+#include "gauss_kernel.h"
+#include "local_fit.h"
+#include "local_cv.h"
+#include "binned_smooth.h"
+
+// the query points are processed in blocks of this many: the kernel weights
+// of a block are one gemm (see gauss_kernel.h). lm_local and
+// lm_local_parallel use the same blocks, so they get the same weights
+const uword kernel_block_size = 32;
+
+// [[Rcpp::export(name = "dmvnorm_Rcpp")]]
+mat dmvnorm_(mat& x, mat& mu, mat& H, bool log = false){
+  // Gaussian density (or log-density) with covariance H at every row of x,
+  // with mean each row of mu: one column per row of mu
+
+  mat L = chol(H, "lower");
+  lmlocal::gauss_kernel kernel(x, L);
+  lmlocal::kernel_block blk;
+
+  kernel.eval(mu, 0, mu.n_rows, blk, log);
+
+  return blk.K;
+}
+
+// [[Rcpp::export(name = "lm_local_Rcpp")]]
+vec lm_local(vec& y, mat& x0, mat& X0, mat& x, mat& X, mat& H){
+  // find coefficients for each row and weight by the Gaussian density kernel
+  // (gauss_kernel.h for the weights of a block of rows at once, local_fit.h
+  // for the fits: the buffers of both are allocated once, not for every row)
+
+  uword nsub = x0.n_rows;
+  vec out(nsub);
+
+  mat L = chol(H, "lower");
+  lmlocal::gauss_kernel kernel(x, L);
+  lmlocal::kernel_block blk;
+
+  lmlocal::workspace ws;
+  ws.resize(x.n_rows, X.n_cols);
+
+  for(uword first=0; first<nsub; first+=kernel_block_size){
+    uword last = std::min(nsub, first + kernel_block_size);
+    kernel.eval(x0, first, last, blk);
+
+    for(uword i=first; i<last; i++){
+      out(i) = lmlocal::fit_weighted(y.memptr(), X.memptr(), X.n_rows, X.n_cols, blk.K.colptr(i - first),
+                                     X0.memptr(), nsub, i, ws);
+    }
+  }
+
+  return out;
+}
+
+// the buffers of one thread
+struct thread_workspace {
+  lmlocal::workspace fit;
+  lmlocal::kernel_block kernel;
+};
+
+// fits the blocks [begin, end) of rows of x0, with the workspace of the thread it runs on
+struct LocalFit : public RcppParallel::Worker {
+  const vec& y;
+  const mat &x0, &X0, &X;
+  const lmlocal::gauss_kernel& kernel;
+  tbb::enumerable_thread_specific<thread_workspace>& workspaces;
+  vec& out;
+
+  LocalFit(const vec& y, const mat& x0, const mat& X0, const mat& X, const lmlocal::gauss_kernel& kernel,
+           tbb::enumerable_thread_specific<thread_workspace>& workspaces, vec& out)
+    : y(y), x0(x0), X0(X0), X(X), kernel(kernel), workspaces(workspaces), out(out) {}
+
+  void operator()(std::size_t begin, std::size_t end){
+    thread_workspace& ws = workspaces.local();
+
+    for(std::size_t b=begin; b<end; b++){
+      uword first = b * kernel_block_size;
+      uword last = std::min(x0.n_rows, first + kernel_block_size);
+      kernel.eval(x0, first, last, ws.kernel);
+
+      for(uword i=first; i<last; i++){
+        out(i) = lmlocal::fit_weighted(y.memptr(), X.memptr(), X.n_rows, X.n_cols, ws.kernel.K.colptr(i - first),
+                                       X0.memptr(), x0.n_rows, i, ws.fit);
+      }
+    }
+  }
+};
+
+// [[Rcpp::export(name = "lm_local_parallel_Rcpp")]]
+vec lm_local_parallel(vec& y, mat& x0, mat& X0, mat& x, mat& X, mat& H){
+  // lm_local with the blocks of rows of x0 spread over threads. Each thread
+  // gets a copy of the workspace the first time it runs a block and reuses
+  // it after, and each fit is computed exactly as in lm_local, so the
+  // results are identical to it whatever the number of threads
+
+  uword nsub = x0.n_rows;
+  vec out(nsub);
+
+  mat L = chol(H, "lower");
+  lmlocal::gauss_kernel kernel(x, L);
+
+  thread_workspace exemplar;
+  exemplar.fit.resize(x.n_rows, X.n_cols);
+  tbb::enumerable_thread_specific<thread_workspace> workspaces(exemplar);
+
+  LocalFit fit(y, x0, X0, X, kernel, workspaces, out);
+  RcppParallel::parallelFor(0, (nsub + kernel_block_size - 1) / kernel_block_size, fit);
+
+  return out;
+}
+
+// [[Rcpp::export(name = "lm_local_trunc_Rcpp")]]
+Rcpp::List lm_local_trunc(vec& y, mat& x0, mat& X0, mat& x, mat& X, mat& H, double radius = 4){
+  // as lm_local, but each fit only uses the points within 'radius' kernel sds
+  // of x0[i, ] (found with a grid over x, see kernel_grid.h), accumulating
+  // X^T W X and X^T W y over them and solving the p x p system. The weights
+  // left out are each below exp(-radius^2 / 2) of the largest possible, so
+  // 'bound' is an upper bound on their total relative to the weights used
+
+  int nsub = x0.n_rows;
+  int n = x.n_rows;
+  int p = X.n_cols;
+
+  if(radius <= 0){
+    Rcpp::stop("radius must be positive");
+  }
+  if((int) x.n_cols > lmlocal::grid::max_dim){
+    Rcpp::stop("x can have at most %d columns", int(lmlocal::grid::max_dim));
+  }
+
+  mat L = chol(H, "lower");
+  lmlocal::grid grid(x.memptr(), n, x.n_cols, L.memptr(), radius);
+
+  // rows of X as columns, so a neighbour's row is contiguous
+  mat Xt = X.t();
+
+  const double wmin = exp(-0.5 * radius * radius);
+
+  vec out(nsub), bound(nsub);
+  Rcpp::IntegerVector count(nsub);
+
+  std::vector<int> idx;
+  std::vector<double> w;
+  mat A(p, p);
+  vec b(p), beta(p);
+  rowvec xi(x.n_cols);
+
+  for(int i=0; i<nsub; i++){
+    xi = x0.row(i);
+    int k = grid.neighbours(xi.memptr(), idx, w);
+    count[i] = k;
+
+    // kernel weights exp(-q/2), dropping the constant (it cancels in the fit)
+    for(int j=0; j<k; j++){
+      w[j] = -0.5 * w[j];
+    }
+    sm_exp(w.data(), w.data(), k);
+
+    A.zeros();
+    b.zeros();
+    double wsum = 0.0;
+
+    for(int j=0; j<k; j++){
+      const double *xr = Xt.colptr(idx[j]);
+      const double wy = w[j] * y[idx[j]];
+      wsum += w[j];
+
+      for(int a=0; a<p; a++){
+        const double wxa = w[j] * xr[a];
+        b[a] += wy * xr[a];
+        for(int c=0; c<=a; c++){
+          A.at(a, c) += wxa * xr[c];
+        }
+      }
+    }
+
+    A = symmatl(A);
+
+    bool ok = k >= p && lmlocal::solve_scaled(A, b, beta);
+
+    out(i) = ok ? as_scalar(X0.row(i) * beta) : NA_REAL;
+    bound(i) = (k > 0) ? (n - k) * wmin / wsum : R_PosInf;
+  }
+
+  return Rcpp::List::create(Rcpp::Named("fit") = out,
+                            Rcpp::Named("neighbours") = count,
+                            Rcpp::Named("bound") = bound);
+}
+
+// the squared LOO residuals of the rows 'rows' (one row of 'out' each) for
+// every bandwidth, with the rows spread over threads
+struct LocalCV : public RcppParallel::Worker {
+  const lmlocal::local_cv& cv;
+  const std::vector<uword>& rows;
+  tbb::enumerable_thread_specific<lmlocal::cv_workspace>& workspaces;
+  mat& out;
+
+  LocalCV(const lmlocal::local_cv& cv, const std::vector<uword>& rows,
+          tbb::enumerable_thread_specific<lmlocal::cv_workspace>& workspaces, mat& out)
+    : cv(cv), rows(rows), workspaces(workspaces), out(out) {}
+
+  void operator()(std::size_t begin, std::size_t end){
+    lmlocal::cv_workspace& ws = workspaces.local();
+    std::vector<double> resid(cv.size());
+
+    for(std::size_t r=begin; r<end; r++){
+      cv.loo(rows[r], ws, resid.data());
+      for(uword g=0; g<cv.size(); g++){
+        out(r, g) = resid[g];
+      }
+    }
+  }
+};
+
+// mean squared LOO residual over 'rows' (0-based) for each row of Hdiag.
+// The residuals are stored per row and summed in order afterwards, so the
+// scores don't depend on the number of threads
+vec cv_scores(const vec& y, const mat& x, const mat& X, const mat& Hdiag, const std::vector<uword>& rows){
+  lmlocal::local_cv cv(y, x, X, Hdiag);
+  tbb::enumerable_thread_specific<lmlocal::cv_workspace> workspaces;
+
+  mat resid(rows.size(), Hdiag.n_rows);
+  LocalCV worker(cv, rows, workspaces, resid);
+  RcppParallel::parallelFor(0, rows.size(), worker);
+
+  return mean(resid, 0).t();
+}
+
+// 1-based row numbers from R to 0-based, checking them
+std::vector<uword> cv_rows(Rcpp::IntegerVector sub, uword n){
+  std::vector<uword> rows(sub.size());
+  for(int i=0; i<sub.size(); i++){
+    if(sub[i] == NA_INTEGER || sub[i] < 1 || uword(sub[i]) > n){
+      Rcpp::stop("sub must contain row numbers of x");
+    }
+    rows[i] = sub[i] - 1;
+  }
+  return rows;
+}
+
+// [[Rcpp::export(name = "lm_local_cv_Rcpp")]]
+vec lm_local_cv(vec& y, mat& x, mat& X, mat& Hdiag, Rcpp::IntegerVector sub){
+  // leave-one-out CV score (mean squared LOO residual over the rows 'sub')
+  // of lm_local with H = diag(Hdiag[g, ]), for every row g of Hdiag. The LOO
+  // residuals come from the leverages of the fits, so each row is fitted
+  // once per bandwidth, and the kernel factors and the products of the
+  // columns of X are shared between bandwidths (see local_cv.h). Inf where
+  // a fit is singular, e.g. a bandwidth so small the row is alone
+
+  if(Hdiag.n_cols != x.n_cols){
+    Rcpp::stop("Hdiag must have one column per column of x");
+  }
+  if(any(vectorise(Hdiag) <= 0)){
+    Rcpp::stop("Hdiag must be positive");
+  }
+
+  return cv_scores(y, x, X, Hdiag, cv_rows(sub, x.n_rows));
+}
+
+// [[Rcpp::export(name = "lm_local_cv_search_Rcpp")]]
+Rcpp::List lm_local_cv_search(vec& y, mat& x, mat& X, vec& lower, vec& upper, Rcpp::IntegerVector sub,
+                              int points = 5, int levels = 3){
+  // coarse-to-fine search for the diagonal bandwidth minimising the LOO CV
+  // score: each level evaluates a grid of 'points' values per dimension,
+  // evenly spaced on the log scale (all points^d combinations in one call
+  // of cv_scores), and the next level spans one step either side of the
+  // best value of the last
+
+  uword d = x.n_cols;
+
+  if(lower.n_elem != d || upper.n_elem != d){
+    Rcpp::stop("lower and upper must have one element per column of x");
+  }
+  if(any(lower <= 0) || any(upper < lower)){
+    Rcpp::stop("need 0 < lower <= upper");
+  }
+  if(points < 2 || levels < 1){
+    Rcpp::stop("need points >= 2 and levels >= 1");
+  }
+
+  std::vector<uword> rows = cv_rows(sub, x.n_rows);
+
+  vec lo = log(lower), hi = log(upper);
+  uword G = 1;
+  for(uword k=0; k<d; k++){
+    G *= points;
+  }
+
+  mat Hdiag(G, d);
+  vec best(d);
+  double best_score = R_PosInf;
+  Rcpp::List history(levels);
+
+  for(int level=0; level<levels; level++){
+    vec step = (hi - lo) / (points - 1);
+
+    // odometer over the grid: row g has value (g / points^k) % points in dimension k
+    for(uword g=0; g<G; g++){
+      uword r = g;
+      for(uword k=0; k<d; k++){
+        Hdiag(g, k) = exp(lo[k] + (r % points) * step[k]);
+        r /= points;
+      }
+    }
+
+    vec score = cv_scores(y, x, X, Hdiag, rows);
+
+    uword g = score.index_min();
+    if(level == 0 || score[g] < best_score){
+      best_score = score[g];
+      best = Hdiag.row(g).t();
+    }
+
+    history[level] = Rcpp::List::create(Rcpp::Named("Hdiag") = Hdiag,
+                                        Rcpp::Named("score") = score);
+
+    lo = log(best) - step;
+    hi = log(best) + step;
+  }
+
+  return Rcpp::List::create(Rcpp::Named("Hdiag") = best,
+                            Rcpp::Named("score") = best_score,
+                            Rcpp::Named("history") = history);
+}
+
+// [[Rcpp::export(name = "lm_local_binned_Rcpp")]]
+Rcpp::List lm_local_binned(vec& y, mat& x0, mat& X0, mat& x, mat& X, mat& H, int m1 = 64, int m2 = 64){
+  // lm_local for two covariates, approximated on an m1 x m2 grid over x:
+  // the data are binned linearly onto the grid, the kernel sums at every
+  // node are FFT convolutions and the local fits are solved at the nodes,
+  // then interpolated to the rows of x0 (see binned_smooth.h). The cost
+  // hardly depends on the number of rows of x0 or the bandwidth
+
+  if(x.n_cols != 2 || x0.n_cols != 2){
+    Rcpp::stop("x and x0 must have two columns");
+  }
+  if(m1 < 2 || m2 < 2){
+    Rcpp::stop("the grid needs at least 2 nodes in each direction");
+  }
+
+  lmlocal::grid2 grid(x, m1, m2);
+  cube coef = lmlocal::binned_coefficients(y, x, X, H, grid);
+
+  vec nodes1(m1), nodes2(m2);
+  for(int i=0; i<m1; i++){
+    nodes1[i] = grid.node(0, i);
+  }
+  for(int j=0; j<m2; j++){
+    nodes2[j] = grid.node(1, j);
+  }
+
+  return Rcpp::List::create(Rcpp::Named("fit") = lmlocal::binned_predict(x0, X0, coef, grid),
+                            Rcpp::Named("coef") = coef,
+                            Rcpp::Named("nodes1") = nodes1,
+                            Rcpp::Named("nodes2") = nodes2);
+}
@@ -0,0 +1,70 @@
+// [[Rcpp::depends(RcppArmadillo, RcppParallel)]]
+#include <RcppArmadillo.h>
+#include <RcppParallel.h>
+using namespace arma;
+
+#include "tsqr.h"
+
+Rcpp::List tsqr_list(const tsqr::factor& f){
+  int q = f.cols();
+  mat R(q, q);
+  for(int j=0; j<q; j++){
+    for(int i=0; i<q; i++){
+      R(i, j) = f(i, j);
+    }
+  }
+
+  std::vector<double> beta = f.coefficients();
+
+  return Rcpp::List::create(Rcpp::Named("coefficients") = Rcpp::NumericVector(beta.begin(), beta.end()),
+                            Rcpp::Named("rss") = f.rss(),
+                            Rcpp::Named("rows") = double(f.rows()),
+                            Rcpp::Named("R") = R);
+}
+
+// [[Rcpp::export(name = "lm_tsqr_Rcpp")]]
+Rcpp::List lm_tsqr(mat& X, vec& y, int block = 4096){
+  // as lm_Rcpp, but by a tall-skinny QR of [X y]: blocks of 'block' rows are
+  // reduced to (p+1) x (p+1) R factors in parallel and merged in a tree, and
+  // Q^T y is the last column of R, so Q (m x p) is never formed
+
+  if(X.n_rows != y.n_elem){
+    Rcpp::stop("X and y must have the same number of rows");
+  }
+  if(block < 1){
+    Rcpp::stop("block must be positive");
+  }
+
+  return tsqr_list(tsqr::fit(X.memptr(), y.memptr(), X.n_rows, X.n_cols, block));
+}
+
+// [[Rcpp::export(name = "lm_tsqr_file_Rcpp")]]
+Rcpp::List lm_tsqr_file(std::string filename, int ncol, std::string format = "binary", int skip = 0,
+                        int block = 4096, int batch = 64){
+  // lm_tsqr on rows of [X y] (ncol columns, y last) read from a file rather
+  // than memory: "binary" for doubles written row by row (mapped into
+  // memory, see tsqr.h), or "csv" for text, skipping 'skip' header lines.
+  // Memory is O(ncol^2) per thread plus the blocks being reduced
+
+  if(ncol < 2){
+    Rcpp::stop("need at least one column of X and y");
+  }
+
+  if(block < 1 || batch < 1){
+    Rcpp::stop("block and batch must be positive");
+  }
+
+  try {
+    if(format == "binary"){
+      return tsqr_list(tsqr::fit_binary(filename, ncol, block));
+    }
+    else if(format == "csv"){
+      return tsqr_list(tsqr::fit_csv(filename, ncol, skip, block, batch));
+    }
+  }
+  catch(std::exception& e){
+    Rcpp::stop(e.what());
+  }
+
+  Rcpp::stop("format must be \"binary\" or \"csv\"");
+}
@@ -0,0 +1,197 @@
+#ifndef local_cv_h
+#define local_cv_h
+
+// include RcppArmadillo.h first when using this from R
+#ifndef ARMA_INCLUDES
+#include <armadillo>
+#endif
+
+#include <cmath>
+#include <vector>
+
+#include "simd_math.h"
+
+namespace lmlocal {
+
+// the products of columns of X (n x p) and y that X^T W X and X^T W y are
+// weighted sums of: X_a X_b for b <= a, then X_a y (one column each)
+inline arma::mat moment_products(const arma::mat &X, const arma::vec &y){
+    const arma::uword p = X.n_cols;
+    arma::mat P(X.n_rows, p * (p + 1) / 2 + p);
+
+    arma::uword c = 0;
+    for(arma::uword a=0; a<p; a++){
+        for(arma::uword b=0; b<=a; b++){
+            P.col(c++) = X.col(a) % X.col(b);
+        }
+    }
+    for(arma::uword a=0; a<p; a++){
+        P.col(c++) = X.col(a) % y;
+    }
+
+    return P;
+}
+
+// X^T W X (A) and X^T W y (b) from their weighted sums of moment_products,
+// s[c * stride] being the sum of column c
+inline void unpack_moments(const double *s, arma::uword stride, arma::uword p, arma::mat &A, arma::vec &b){
+    A.set_size(p, p);
+    b.set_size(p);
+
+    arma::uword c = 0;
+    for(arma::uword a=0; a<p; a++){
+        for(arma::uword k=0; k<=a; k++){
+            A(a, k) = A(k, a) = s[c++ * stride];
+        }
+    }
+    for(arma::uword a=0; a<p; a++){
+        b[a] = s[c++ * stride];
+    }
+}
+
+// solves A X = B for a local fit's X^T W X (A), scaling A to a unit
+// diagonal first: columns like x^2 can be orders of magnitude larger than
+// the intercept. A is overwritten; false if A is singular or has a zero
+// on its diagonal
+inline bool solve_scaled(arma::mat &A, const arma::mat &B, arma::mat &X){
+    const arma::vec D = 1.0 / arma::sqrt(A.diag());
+    if(!D.is_finite()){
+        return false;
+    }
+
+    A %= D * D.t();
+    if(!arma::solve(X, A, B.each_col() % D, arma::solve_opts::likely_sympd + arma::solve_opts::no_approx)){
+        return false;
+    }
+
+    X.each_col() %= D;
+    return true;
+}
+
+// buffers for the leave-one-out residuals of one row, reused between rows
+struct cv_workspace {
+    arma::mat F;      // per-dimension kernel factors, one column per distinct bandwidth value
+    arma::mat W;      // kernel weights, one column per bandwidth
+    arma::mat S;      // X^T W X and X^T W y entries, one row per bandwidth
+    arma::mat A, rhs, sol;
+    arma::vec b;
+};
+
+// leave-one-out cross-validation of the local regression of y on X over a
+// set of diagonal bandwidths (the rows of Hdiag). For a row i of the data
+// the LOO residual is e_i / (1 - h_ii), where e_i is the residual of the
+// fit at x_i and h_ii = w_ii x_i^T (X^T W X)^-1 x_i its leverage, so no
+// refitting is needed. Three things are shared between bandwidths:
+//
+//  - the kernel weight of row j is the product over dimensions k of
+//    exp(-(x_jk - x_ik)^2 / 2 H_kk), so the factors are computed once for
+//    each distinct value of H_kk in the grid, not for every bandwidth;
+//  - X^T W X and X^T W y are sums over rows of the weights times products
+//    of columns of X and y, which don't depend on the bandwidth, so the
+//    products are computed once (P) and the sums for all the bandwidths
+//    are one matrix product W^T P;
+//  - the normalising constant of the kernel cancels, and w_ii = 1.
+class local_cv {
+public:
+    local_cv(const arma::vec &y, const arma::mat &x, const arma::mat &X, const arma::mat &Hdiag)
+        : y(y), x(x), X(X), p(X.n_cols), G(Hdiag.n_rows), index(Hdiag.n_rows, Hdiag.n_cols)
+    {
+        P = moment_products(X, y);
+
+        // the distinct values of each diagonal element, and which one each bandwidth uses
+        for(arma::uword k=0; k<Hdiag.n_cols; k++){
+            for(arma::uword g=0; g<G; g++){
+                arma::uword v = 0;
+                while(v < values.size() && !(dim[v] == k && values[v] == Hdiag(g, k))){
+                    v++;
+                }
+                if(v == values.size()){
+                    values.push_back(Hdiag(g, k));
+                    dim.push_back(k);
+                }
+                index(g, k) = v;
+            }
+        }
+    }
+
+    // the squared LOO residual of row i for every bandwidth, written to
+    // out[0 .. G); INFINITY where the fit is singular or h_ii = 1
+    void loo(arma::uword i, cv_workspace &ws, double *out) const {
+        const arma::uword n = x.n_rows;
+
+        ws.F.set_size(n, values.size());
+        for(arma::uword v=0; v<values.size(); v++){
+            const double coef = -0.5 / values[v];
+            const double *xk = x.colptr(dim[v]);
+            const double xik = xk[i];
+            double *f = ws.F.colptr(v);
+            for(arma::uword j=0; j<n; j++){
+                f[j] = coef * (xk[j] - xik) * (xk[j] - xik);
+            }
+        }
+        sm_exp(ws.F.memptr(), ws.F.memptr(), ws.F.n_elem);
+
+        ws.W.set_size(n, G);
+        for(arma::uword g=0; g<G; g++){
+            double *w = ws.W.colptr(g);
+            const double *f = ws.F.colptr(index(g, 0));
+            for(arma::uword j=0; j<n; j++){
+                w[j] = f[j];
+            }
+            for(arma::uword k=1; k<index.n_cols; k++){
+                f = ws.F.colptr(index(g, k));
+                for(arma::uword j=0; j<n; j++){
+                    w[j] *= f[j];
+                }
+            }
+        }
+
+        ws.S = ws.W.t() * P;
+
+        ws.rhs.set_size(p, 2);
+        const arma::rowvec xi = X.row(i);
+
+        for(arma::uword g=0; g<G; g++){
+            unpack_moments(ws.S.memptr() + g, G, p, ws.A, ws.b);
+
+            // beta and (X^T W X)^-1 x_i in one solve
+            for(arma::uword a=0; a<p; a++){
+                ws.rhs(a, 0) = ws.b[a];
+                ws.rhs(a, 1) = xi[a];
+            }
+
+            bool ok = solve_scaled(ws.A, ws.rhs, ws.sol);
+
+            double fit = 0.0, h = 0.0;
+            if(ok){
+                for(arma::uword a=0; a<p; a++){
+                    fit += xi[a] * ws.sol(a, 0);
+                    h += xi[a] * ws.sol(a, 1);
+                }
+            }
+
+            if(ok && h < 1.0){
+                const double e = (y[i] - fit) / (1.0 - h);
+                out[g] = e * e;
+            }
+            else {
+                out[g] = INFINITY;
+            }
+        }
+    }
+
+    arma::uword size() const { return G; }
+
+private:
+    const arma::vec &y;
+    const arma::mat &x, &X;
+    arma::uword p, G;
+    arma::mat P;                       // products of columns of X and y
+    std::vector<double> values;        // distinct diagonal elements of the bandwidths...
+    std::vector<arma::uword> dim;      // ... and their dimensions
+    arma::umat index;                  // index(g, k): the value H_kk of bandwidth g uses
+};
+
+}
+
+#endif
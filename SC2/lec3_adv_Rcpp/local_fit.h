@@ -0,0 +1,116 @@
+#ifndef local_fit_h
+#define local_fit_h
+
+#include <cmath>
+#include <vector>
+
+namespace lmlocal {
+
+// buffers for one local fit, sized once and reused for every query point,
+// so fitting allocates nothing. Each thread has its own
+struct workspace {
+    std::vector<double> w;     // square roots of the kernel weights (n)
+    std::vector<double> Xw;    // weighted X (n x p, column-major), overwritten by its QR
+    std::vector<double> yw;    // weighted y (n), overwritten by Q^T y
+    std::vector<double> beta;  // coefficients (p)
+
+    void resize(int n, int p){
+        w.resize(n);
+        Xw.resize(size_t(n) * p);
+        yw.resize(n);
+        beta.resize(p);
+    }
+};
+
+// least squares solution of A beta = b (A n x p, column-major, n >= p) by
+// Householder QR. A and b are overwritten. Returns false if A is rank
+// deficient
+inline bool householder_ls(double *A, int n, int p, double *b, double *beta){
+    for(int k=0; k<p; k++){
+        double *a = A + size_t(k) * n;
+
+        double norm = 0.0;
+        for(int i=k; i<n; i++){
+            norm += a[i] * a[i];
+        }
+        norm = std::sqrt(norm);
+
+        if(norm == 0.0){
+            return false;
+        }
+
+        // v = a[k:n] + sign(a[k]) |a[k:n]| e_1, stored in a[k:n]; R[k,k] = -sign(a[k]) |a[k:n]|
+        const double alpha = (a[k] > 0) ? -norm : norm;
+        a[k] -= alpha;
+        const double vtv = -2.0 * alpha * a[k];    // = v^T v
+
+        // apply H = I - 2 v v^T / v^T v to the remaining columns and to b
+        for(int j=k+1; j<p; j++){
+            double *c = A + size_t(j) * n;
+            double s = 0.0;
+            for(int i=k; i<n; i++){
+                s += a[i] * c[i];
+            }
+            s = 2.0 * s / vtv;
+            for(int i=k; i<n; i++){
+                c[i] -= s * a[i];
+            }
+        }
+
+        double s = 0.0;
+        for(int i=k; i<n; i++){
+            s += a[i] * b[i];
+        }
+        s = 2.0 * s / vtv;
+        for(int i=k; i<n; i++){
+            b[i] -= s * a[i];
+        }
+
+        a[k] = alpha;
+    }
+
+    // back substitution with R (upper triangle of A)
+    for(int k=p-1; k>=0; k--){
+        double s = b[k];
+        for(int j=k+1; j<p; j++){
+            s -= A[k + size_t(j) * n] * beta[j];
+        }
+        beta[k] = s / A[k + size_t(k) * n];
+    }
+
+    return true;
+}
+
+// X0[row, ] %*% the coefficients of y ~ X weighted by 'weights' (the
+// kernel weights of the n rows around query point 'row'). X is n x p and
+// X0 is nsub x p, both column-major
+inline double fit_weighted(const double *y, const double *X, int n, int p, const double *weights,
+                           const double *X0, int nsub, int row, workspace &ws){
+    for(int i=0; i<n; i++){
+        ws.w[i] = std::sqrt(weights[i]);
+        ws.yw[i] = y[i] * ws.w[i];
+    }
+
+    for(int j=0; j<p; j++){
+        const double *c = X + size_t(j) * n;
+        double *cw = ws.Xw.data() + size_t(j) * n;
+        for(int i=0; i<n; i++){
+            cw[i] = c[i] * ws.w[i];
+        }
+    }
+
+    if(!householder_ls(ws.Xw.data(), n, p, ws.yw.data(), ws.beta.data())){
+        return NAN;
+    }
+
+    double fit = 0.0;
+    for(int j=0; j<p; j++){
+        fit += X0[row + size_t(j) * nsub] * ws.beta[j];
+    }
+
+    return fit;
+}
+
+}
+
+#endif
@@ -0,0 +1,100 @@
+// [[Rcpp::depends(RcppArmadillo)]]
+#include <RcppArmadillo.h>
+using namespace arma;
+
+#include "ls_model.h"
+
+// a least squares model kept in C++ between calls (see ls_model.h): the R
+// factor and Householder reflectors of X, and Q^T Y for the responses
+// given with the rows
+
+// [[Rcpp::export(name = "ls_model_Rcpp")]]
+Rcpp::XPtr<lsq::model> ls_model(mat& X, mat& Y){
+  // factorise X once, O(m p^2); Y can have several columns
+
+  if(X.n_rows != Y.n_rows){
+    Rcpp::stop("X and Y must have the same number of rows");
+  }
+  if(X.n_rows < X.n_cols){
+    Rcpp::stop("X needs at least as many rows as columns");
+  }
+
+  return Rcpp::XPtr<lsq::model>(new lsq::model(X.memptr(), Y.memptr(), X.n_rows, X.n_cols, Y.n_cols), true);
+}
+
+// [[Rcpp::export(name = "ls_coef_Rcpp")]]
+Rcpp::List ls_coef(SEXP model){
+  // coefficients (one column per response) and residual sums of squares of
+  // the responses given with the rows, O(p^2) each
+
+  Rcpp::XPtr<lsq::model> m(model);
+
+  mat B(m->cols(), m->responses());
+  m->coefficients(B.memptr());
+
+  return Rcpp::List::create(Rcpp::Named("coefficients") = B,
+                            Rcpp::Named("rss") = m->rss(),
+                            Rcpp::Named("rows") = double(m->rows()));
+}
+
+// [[Rcpp::export(name = "ls_solve_Rcpp")]]
+mat ls_solve(SEXP model, mat& Y){
+  // coefficients of new responses (the columns of Y, one row per current
+  // row of the model) without factorising X again
+
+  Rcpp::XPtr<lsq::model> m(model);
+
+  if((long) Y.n_rows != m->rows()){
+    Rcpp::stop("Y must have %d rows", int(m->rows()));
+  }
+
+  mat B(m->cols(), Y.n_cols);
+  m->solve(Y.memptr(), Y.n_cols, B.memptr());
+
+  return B;
+}
+
+// [[Rcpp::export(name = "ls_add_rows_Rcpp")]]
+void ls_add_rows(SEXP model, mat& X, mat& Y){
+  // append rows of X and Y, updating the factor by Givens rotations
+
+  Rcpp::XPtr<lsq::model> m(model);
+
+  if((int) X.n_cols != m->cols() || (int) Y.n_cols != m->responses() || X.n_rows != Y.n_rows){
+    Rcpp::stop("X must have %d columns and Y %d, with the same number of rows", m->cols(), m->responses());
+  }
+
+  m->add_rows(X.memptr(), Y.memptr(), X.n_rows);
+}
+
+// [[Rcpp::export(name = "ls_remove_rows_Rcpp")]]
+void ls_remove_rows(SEXP model, Rcpp::IntegerVector rows){
+  // remove rows (1-based, in the model's current order: rows added later
+  // come after the original ones), downdating the factor
+
+  Rcpp::XPtr<lsq::model> m(model);
+
+  std::vector<long> idx(rows.size());
+  for(int i=0; i<rows.size(); i++){
+    if(rows[i] == NA_INTEGER){
+      Rcpp::stop("rows can't be NA");
+    }
+    idx[i] = long(rows[i]) - 1;
+  }
+
+  try {
+    m->remove_rows(idx);
+  }
+  catch(std::exception& e){
+    Rcpp::stop(e.what());
+  }
+}
+
+// [[Rcpp::export(name = "ls_refactor_Rcpp")]]
+void ls_refactor(SEXP model){
+  // factorise the current rows again, O(m p^2), so ls_solve_Rcpp uses the
+  // reflectors rather than the semi-normal equations
+
+  Rcpp::XPtr<lsq::model> m(model);
+  m->refactor();
+}
@@ -0,0 +1,392 @@
+#ifndef ls_model_h
+#define ls_model_h
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+// least squares fits of several responses on the same X that are kept
+// between calls, for refitting with new responses or after adding or
+// removing a few rows without factorising X again
+namespace lsq {
+
+class model {
+public:
+    // X (m x p) and the responses Y (m x k), both column-major. Y may have
+    // no columns
+    model(const double *X, const double *Y, long m, int p, int k)
+        : m(m), p(p), k(k), xr(size_t(m) * p), yr(size_t(m) * k)
+    {
+        if(m < p){
+            throw std::runtime_error("X needs at least as many rows as columns");
+        }
+        for(long i=0; i<m; i++){
+            for(int j=0; j<p; j++){
+                xr[size_t(i) * p + j] = X[i + size_t(j) * m];
+            }
+            for(int j=0; j<k; j++){
+                yr[size_t(i) * k + j] = Y[i + size_t(j) * m];
+            }
+        }
+        refactor();
+    }
+
+    // Householder QR of the current rows, O(m p^2): R, the reflectors, and
+    // Q^T Y (z, the first p rows, and rho, the norms of the rest)
+    void refactor(){
+        V.assign(size_t(m) * p, 0.0);
+        for(long i=0; i<m; i++){
+            for(int j=0; j<p; j++){
+                V[i + size_t(j) * m] = xr[size_t(i) * p + j];
+            }
+        }
+
+        R.assign(size_t(p) * p, 0.0);
+        beta.assign(p, 0.0);
+
+        for(int c=0; c<p; c++){
+            double *a = &V[size_t(c) * m];
+
+            double norm = 0.0;
+            for(long i=c; i<m; i++){
+                norm += a[i] * a[i];
+            }
+            norm = std::sqrt(norm);
+
+            if(norm == 0.0){
+                continue;
+            }
+
+            // v = a[c:m] + sign(a[c]) |a[c:m]| e_1, left in a[c:m]
+            const double alpha = (a[c] > 0) ? -norm : norm;
+            a[c] -= alpha;
+            beta[c] = 2.0 / (-2.0 * alpha * a[c]);    // 2 / v^T v
+
+            for(int j=c+1; j<p; j++){
+                reflect(c, &V[size_t(j) * m]);
+            }
+
+            R[c + size_t(c) * p] = alpha;
+        }
+
+        // R above the diagonal, and zero it in V so V only holds the reflectors
+        for(int j=0; j<p; j++){
+            for(int i=0; i<j; i++){
+                R[i + size_t(j) * p] = V[i + size_t(j) * m];
+                V[i + size_t(j) * m] = 0.0;
+            }
+        }
+
+        z.assign(size_t(p) * k, 0.0);
+        rho.assign(k, 0.0);
+
+        std::vector<double> y(m);
+        for(int j=0; j<k; j++){
+            for(long i=0; i<m; i++){
+                y[i] = yr[size_t(i) * k + j];
+            }
+            apply_qt(y.data());
+            for(int i=0; i<p; i++){
+                z[i + size_t(j) * p] = y[i];
+            }
+            double ss = 0.0;
+            for(long i=p; i<m; i++){
+                ss += y[i] * y[i];
+            }
+            rho[j] = std::sqrt(ss);
+        }
+
+        fresh = true;
+    }
+
+    // coefficients (p x k2, column-major) of new responses Y2 (m x k2,
+    // column-major, in the order of the current rows). While the
+    // reflectors match the rows, Q^T y is applied with them; after rows
+    // have been added or removed this uses the corrected semi-normal
+    // equations R^T R b = X^T y with one step of refinement (Bjorck, BIT
+    // 1987), which are as accurate for well-conditioned X. Either way the
+    // cost is O(m p) per response plus O(p^2) for the solve
+    void solve(const double *Y2, int k2, double *B) const {
+        std::vector<double> y(m), g(p), d(p);
+
+        for(int j=0; j<k2; j++){
+            const double *yj = Y2 + size_t(j) * m;
+            double *b = B + size_t(j) * p;
+
+            if(fresh){
+                std::copy(yj, yj + m, y.begin());
+                apply_qt(y.data());
+                back_substitute(y.data(), b);
+                continue;
+            }
+
+            // b = R^-1 R^-T X^T y, then the same for the residual
+            crossprod(yj, g.data());
+            seminormal(g.data(), b);
+
+            for(long i=0; i<m; i++){
+                const double *x = &xr[size_t(i) * p];
+                double fit = 0.0;
+                for(int a=0; a<p; a++){
+                    fit += x[a] * b[a];
+                }
+                y[i] = yj[i] - fit;
+            }
+            crossprod(y.data(), g.data());
+            seminormal(g.data(), d.data());
+
+            for(int a=0; a<p; a++){
+                b[a] += d[a];
+            }
+        }
+    }
+
+    // coefficients (p x k, column-major) of the responses given with the
+    // rows, O(p^2) each
+    void coefficients(double *B) const {
+        for(int j=0; j<k; j++){
+            back_substitute(&z[size_t(j) * p], B + size_t(j) * p);
+        }
+    }
+
+    // residual sums of squares of the responses given with the rows
+    std::vector<double> rss() const {
+        std::vector<double> out(k);
+        for(int j=0; j<k; j++){
+            out[j] = rho[j] * rho[j];
+        }
+        return out;
+    }
+
+    // append the rows (X mn x p, Y mn x k, column-major), updating R, z and
+    // rho by Givens rotations (LINPACK dchud), O(p (p + k)) per row
+    void add_rows(const double *X, const double *Y, long mn){
+        std::vector<double> x(p), y(k), c(p), s(p);
+
+        for(long r=0; r<mn; r++){
+            for(int j=0; j<p; j++){
+                x[j] = X[r + size_t(j) * mn];
+            }
+            for(int j=0; j<k; j++){
+                y[j] = Y[r + size_t(j) * mn];
+            }
+
+            // rotate x into R a column at a time
+            for(int j=0; j<p; j++){
+                double xj = x[j];
+                for(int i=0; i<j; i++){
+                    double &rij = R[i + size_t(j) * p];
+                    const double t = c[i] * rij + s[i] * xj;
+                    xj = c[i] * xj - s[i] * rij;
+                    rij = t;
+                }
+                givens(R[j + size_t(j) * p], xj, c[j], s[j]);
+            }
+
+            // the same rotations on z; what is left of y adds to rho
+            for(int j=0; j<k; j++){
+                double zeta = y[j];
+                for(int i=0; i<p; i++){
+                    double &zij = z[i + size_t(j) * p];
+                    const double t = c[i] * zij + s[i] * zeta;
+                    zeta = c[i] * zeta - s[i] * zij;
+                    zij = t;
+                }
+                rho[j] = std::hypot(rho[j], zeta);
+            }
+
+            xr.insert(xr.end(), x.begin(), x.end());
+            yr.insert(yr.end(), y.begin(), y.end());
+        }
+
+        m += mn;
+        fresh = fresh && mn == 0;
+    }
+
+    // remove the rows 'idx' (0-based, in the current order), downdating R,
+    // z and rho (LINPACK dchdd), O(p (p + k)) per row plus compacting the
+    // stored rows. Throws, leaving the model unchanged, if X without those
+    // rows would be (numerically) rank deficient
+    void remove_rows(std::vector<long> idx){
+        std::sort(idx.begin(), idx.end());
+        idx.erase(std::unique(idx.begin(), idx.end()), idx.end());
+
+        if(!idx.empty() && (idx.front() < 0 || idx.back() >= m)){
+            throw std::runtime_error("row index out of range");
+        }
+        if(m - long(idx.size()) < p){
+            throw std::runtime_error("X needs at least as many rows as columns");
+        }
+
+        std::vector<double> R2(R), z2(z), rho2(rho);
+        std::vector<double> a(p), c(p);
+
+        for(long r : idx){
+            const double *x = &xr[size_t(r) * p];
+            const double *y = &yr[size_t(r) * k];
+
+            // R^T a = x
+            double norm = 0.0;
+            for(int j=0; j<p; j++){
+                double t = x[j];
+                for(int i=0; i<j; i++){
+                    t -= R2[i + size_t(j) * p] * a[i];
+                }
+                a[j] = t / R2[j + size_t(j) * p];
+                norm += a[j] * a[j];
+            }
+
+            if(!(norm < 1.0)){
+                throw std::runtime_error("removing the rows would leave X rank deficient");
+            }
+
+            // the rotations, from the last row of R up
+            double alpha = std::sqrt(1.0 - norm);
+            for(int i=p-1; i>=0; i--){
+                const double scale = alpha + std::fabs(a[i]);
+                const double ca = alpha / scale, sb = a[i] / scale;
+                const double h = std::sqrt(ca * ca + sb * sb);
+                c[i] = ca / h;
+                a[i] = sb / h;
+                alpha = scale * h;
+            }
+
+            for(int j=0; j<p; j++){
+                double xx = 0.0;
+                for(int i=j; i>=0; i--){
+                    double &rij = R2[i + size_t(j) * p];
+                    const double t = c[i] * xx + a[i] * rij;
+                    rij = c[i] * rij - a[i] * xx;
+                    xx = t;
+                }
+            }
+
+            for(int j=0; j<k; j++){
+                double zeta = y[j];
+                for(int i=0; i<p; i++){
+                    double &zij = z2[i + size_t(j) * p];
+                    zij = (zij - a[i] * zeta) / c[i];
+                    zeta = c[i] * zeta - a[i] * zij;
+                }
+                // |zeta| > rho only by rounding, when the row was fitted exactly
+                const double azeta = std::fabs(zeta);
+                rho2[j] = (azeta < rho2[j]) ? rho2[j] * std::sqrt(1.0 - (azeta / rho2[j]) * (azeta / rho2[j])) : 0.0;
+            }
+        }
+
+        R.swap(R2);
+        z.swap(z2);
+        rho.swap(rho2);
+
+        // compact the stored rows
+        long to = 0;
+        size_t next = 0;
+        for(long i=0; i<m; i++){
+            if(next < idx.size() && idx[next] == i){
+                next++;
+                continue;
+            }
+            std::copy(&xr[size_t(i) * p], &xr[size_t(i) * p] + p, &xr[size_t(to) * p]);
+            std::copy(&yr[size_t(i) * k], &yr[size_t(i) * k] + k, &yr[size_t(to) * k]);
+            to++;
+        }
+        m = to;
+        xr.resize(size_t(m) * p);
+        yr.resize(size_t(m) * k);
+
+        fresh = fresh && idx.empty();
+    }
+
+    long rows() const { return m; }
+    int cols() const { return p; }
+    int responses() const { return k; }
+
+    // the reflectors are those of the current rows (no rows added or
+    // removed since the last refactor)
+    bool is_fresh() const { return fresh; }
+
+    double R_at(int i, int j) const { return R[i + size_t(j) * p]; }
+
+private:
+    // y[c:m] -= beta_c v_c (v_c^T y[c:m])
+    void reflect(int c, double *y) const {
+        const double *v = &V[size_t(c) * m];
+        double s = 0.0;
+        for(long i=c; i<m; i++){
+            s += v[i] * y[i];
+        }
+        s *= beta[c];
+        for(long i=c; i<m; i++){
+            y[i] -= s * v[i];
+        }
+    }
+
+    void apply_qt(double *y) const {
+        for(int c=0; c<p; c++){
+            if(beta[c] != 0.0){
+                reflect(c, y);
+            }
+        }
+    }
+
+    // R b = zj (NaN from the first zero pivot up)
+    void back_substitute(const double *zj, double *b) const {
+        for(int i=p-1; i>=0; i--){
+            double t = zj[i];
+            for(int j=i+1; j<p; j++){
+                t -= R[i + size_t(j) * p] * b[j];
+            }
+            b[i] = (R[i + size_t(i) * p] != 0.0) ? t / R[i + size_t(i) * p] : NAN;
+        }
+    }
+
+    // g = X^T y over the current rows
+    void crossprod(const double *y, double *g) const {
+        std::fill(g, g + p, 0.0);
+        for(long i=0; i<m; i++){
+            const double *x = &xr[size_t(i) * p];
+            for(int a=0; a<p; a++){
+                g[a] += x[a] * y[i];
+            }
+        }
+    }
+
+    // b = R^-1 R^-T g
+    void seminormal(const double *g, double *b) const {
+        std::vector<double> t(p);
+        for(int j=0; j<p; j++){
+            double s = g[j];
+            for(int i=0; i<j; i++){
+                s -= R[i + size_t(j) * p] * t[i];
+            }
+            t[j] = s / R[j + size_t(j) * p];
+        }
+        back_substitute(t.data(), b);
+    }
+
+    // rotation (c, s) taking (a, b) to (r, 0), with a overwritten by r
+    static void givens(double &a, double b, double &c, double &s){
+        const double r = std::hypot(a, b);
+        if(r == 0.0){
+            c = 1.0;
+            s = 0.0;
+            return;
+        }
+        c = a / r;
+        s = b / r;
+        a = r;
+    }
+
+    long m;
+    int p, k;
+    std::vector<double> xr, yr;      // the current rows of X and Y, row by row
+    std::vector<double> V, beta;     // Householder vectors (m x p) and 2 / v^T v
+    std::vector<double> R;           // p x p, upper triangular
+    std::vector<double> z, rho;      // Q^T Y: first p rows (p x k), and the norms of the rest
+    bool fresh;
+};
+
+}
+
+#endif
@@ -0,0 +1,377 @@
+#ifndef tsqr_h
+#define tsqr_h
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_reduce.h>
+
+// tall-skinny QR for least squares on more rows than fit in memory. The
+// rows of [X y] (q = p + 1 columns) are read in blocks; each block is
+// reduced to the q x q triangular factor R of [R_so_far; block] by
+// Householder reflections, and the factors of different blocks are merged
+// the same way. The last column of R holds Q^T y on top of the residual
+// norm, so Q is never formed and the memory needed is O(q^2) per thread
+// plus one block, whatever the number of rows
+namespace tsqr {
+
+// R factor of the rows of [X y] absorbed so far (q x q, upper triangular,
+// column-major)
+class factor {
+public:
+    factor(int q = 0) : q(q), nrows(0), R(size_t(q) * q, 0.0) {}
+
+    // absorb the m rows of A (m x q, column-major): R becomes the R factor
+    // of [R; A]. A is overwritten
+    void absorb(double *A, long m){
+        for(int k=0; k<q; k++){
+            double *a = A + size_t(k) * m;
+            double &rkk = R[k + size_t(k) * q];
+
+            // only R[k, k] and the block's column k are non-zero at and below the diagonal
+            double norm = rkk * rkk;
+            for(long i=0; i<m; i++){
+                norm += a[i] * a[i];
+            }
+            norm = std::sqrt(norm);
+
+            if(norm == 0.0){
+                continue;
+            }
+
+            // v = (R[k, k] - alpha, a), the rest of v being zero
+            const double alpha = (rkk > 0) ? -norm : norm;
+            const double v0 = rkk - alpha;
+            const double vtv = -2.0 * alpha * v0;
+
+            for(int j=k+1; j<q; j++){
+                double *c = A + size_t(j) * m;
+                double &rkj = R[k + size_t(j) * q];
+
+                double s = v0 * rkj;
+                for(long i=0; i<m; i++){
+                    s += a[i] * c[i];
+                }
+                s = 2.0 * s / vtv;
+
+                rkj -= s * v0;
+                for(long i=0; i<m; i++){
+                    c[i] -= s * a[i];
+                }
+            }
+
+            rkk = alpha;
+        }
+
+        nrows += m;
+    }
+
+    // R becomes the R factor of [R; other.R]
+    void merge(const factor &other){
+        std::vector<double> A(other.R);
+        long n = nrows + other.nrows;
+        absorb(A.data(), q);
+        nrows = n;
+    }
+
+    int cols() const { return q; }
+    long rows() const { return nrows; }
+
+    double operator()(int i, int j) const { return R[i + size_t(j) * q]; }
+
+    // least squares coefficients of y on X, by back substitution with the
+    // first p columns of R (NaN from the first zero pivot up if X is rank
+    // deficient)
+    std::vector<double> coefficients() const {
+        const int p = q - 1;
+        std::vector<double> beta(p);
+
+        for(int k=p-1; k>=0; k--){
+            double s = (*this)(k, p);
+            for(int j=k+1; j<p; j++){
+                s -= (*this)(k, j) * beta[j];
+            }
+            beta[k] = ((*this)(k, k) != 0.0) ? s / (*this)(k, k) : NAN;
+        }
+
+        return beta;
+    }
+
+    // residual sum of squares
+    double rss() const {
+        return (*this)(q - 1, q - 1) * (*this)(q - 1, q - 1);
+    }
+
+private:
+    int q;
+    long nrows;
+    std::vector<double> R;
+};
+
+// the rows [0, nrows) of any source that can copy rows [first, first +
+// count) of [X y] into a count x q column-major block, split into blocks of
+// 'block' rows and reduced in parallel. The blocks are merged in a fixed
+// tree (parallel_deterministic_reduce), so the result is the same for any
+// number of threads
+template <class SOURCE>
+factor reduce(const SOURCE &src, long first, long nrows, long block){
+    const int q = src.cols();
+    const long nblocks = (nrows + block - 1) / block;
+
+    tbb::enumerable_thread_specific<std::vector<double> > buffers(size_t(block) * q);
+
+    return tbb::parallel_deterministic_reduce(
+        tbb::blocked_range<long>(0, nblocks, 1), factor(q),
+        [&](const tbb::blocked_range<long> &range, factor f){
+            std::vector<double> &A = buffers.local();
+            for(long b=range.begin(); b<range.end(); b++){
+                const long start = b * block;
+                const long count = std::min(block, nrows - start);
+                src.read(first + start, count, A.data());
+                f.absorb(A.data(), count);
+            }
+            return f;
+        },
+        [](factor a, const factor &b){
+            a.merge(b);
+            return a;
+        });
+}
+
+// X (m x p, column-major as in armadillo) and y in memory
+class matrix_source {
+public:
+    matrix_source(const double *X, const double *y, long m, int p) : X(X), y(y), m(m), p(p) {}
+
+    long rows() const { return m; }
+    int cols() const { return p + 1; }
+
+    void read(long first, long count, double *A) const {
+        for(int j=0; j<p; j++){
+            std::copy(X + size_t(j) * m + first, X + size_t(j) * m + first + count, A + size_t(j) * count);
+        }
+        std::copy(y + first, y + first + count, A + size_t(p) * count);
+    }
+
+private:
+    const double *X, *y;
+    long m;
+    int p;
+};
+
+// a file of doubles holding the rows of [X y] one after another (as written
+// by writeBin(as.vector(t(cbind(X, y))), f)), mapped into memory so the
+// blocks are read from disk as they are used
+class binary_source {
+public:
+    binary_source(const std::string &filename, int ncol) : q(ncol), base(nullptr), length(0) {
+        if(ncol < 2){
+            throw std::runtime_error("need at least one column of X and y");
+        }
+
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd < 0){
+            throw std::runtime_error("could not open " + filename);
+        }
+
+        struct stat st;
+        fstat(fd, &st);
+        length = st.st_size;
+
+        if(length % (sizeof(double) * q) != 0){
+            ::close(fd);
+            throw std::runtime_error(filename + " is not a whole number of rows of " + std::to_string(q) + " doubles");
+        }
+
+        if(length > 0){
+            base = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+
+        if(base == MAP_FAILED){
+            base = nullptr;
+            throw std::runtime_error("could not map " + filename);
+        }
+
+        if(base != nullptr){
+            madvise(base, length, MADV_SEQUENTIAL);
+        }
+    }
+
+    ~binary_source(){
+        if(base != nullptr){
+            munmap(base, length);
+        }
+    }
+
+    binary_source(const binary_source&) = delete;
+    binary_source& operator=(const binary_source&) = delete;
+
+    long rows() const { return length / (sizeof(double) * q); }
+    int cols() const { return q; }
+
+    // transposes the rows into the column-major block
+    void read(long first, long count, double *A) const {
+        const double *x = static_cast<const double*>(base) + size_t(first) * q;
+        for(long i=0; i<count; i++){
+            for(int j=0; j<q; j++){
+                A[i + size_t(j) * count] = x[size_t(i) * q + j];
+            }
+        }
+    }
+
+private:
+    int q;
+    void *base;
+    size_t length;
+};
+
+// a comma (or white space) separated text file with the columns of [X y],
+// read front to back. It can't be split between threads, so fit_csv reads
+// a batch of blocks at a time and reduces the batch in parallel
+class csv_source {
+public:
+    csv_source(const std::string &filename, int ncol, int skip = 0)
+        : q(ncol), line(nullptr), size(0), lineno(0), nread(0)
+    {
+        file = std::fopen(filename.c_str(), "r");
+        if(file == nullptr){
+            throw std::runtime_error("could not open " + filename);
+        }
+        for(int i=0; i<skip && next_line(); i++){
+        }
+    }
+
+    ~csv_source(){
+        std::fclose(file);
+        std::free(line);
+    }
+
+    csv_source(const csv_source&) = delete;
+    csv_source& operator=(const csv_source&) = delete;
+
+    int cols() const { return q; }
+
+    // reads up to 'count' rows into buf (row-major); returns the number read
+    long read_rows(long count, std::vector<double> &buf){
+        buf.resize(size_t(count) * q);
+        long i = 0;
+
+        while(i < count && next_line()){
+            char *s = line, *end;
+            while(*s == ' ' || *s == '\t'){
+                s++;
+            }
+            if(*s == '\n' || *s == '\r' || *s == '\0'){
+                continue;
+            }
+
+            for(int j=0; j<q; j++){
+                errno = 0;
+                double v = std::strtod(s, &end);
+                if(end == s || errno == ERANGE){
+                    throw std::runtime_error("line " + std::to_string(lineno) + ": expected " +
+                                             std::to_string(q) + " numbers");
+                }
+                buf[size_t(i) * q + j] = v;
+                s = end;
+                while(*s == ' ' || *s == '\t' || (j < q - 1 && *s == ',')){
+                    s++;
+                }
+            }
+
+            // y is the last column, so a longer line is the wrong ncol, not extra data to skip
+            if(*s != '\n' && *s != '\r' && *s != '\0'){
+                throw std::runtime_error("line " + std::to_string(lineno) + ": more than " +
+                                         std::to_string(q) + " numbers");
+            }
+
+            i++;
+        }
+
+        nread += i;
+        return i;
+    }
+
+    long rows() const { return nread; }
+
+private:
+    bool next_line(){
+        if(getline(&line, &size, file) < 0){
+            return false;
+        }
+        lineno++;
+        return true;
+    }
+
+    int q;
+    FILE *file;
+    char *line;
+    size_t size;
+    long lineno, nread;
+};
+
+// rows already in memory, row-major, as a source for reduce
+class rows_source {
+public:
+    rows_source(const double *x, int q) : x(x), q(q) {}
+
+    int cols() const { return q; }
+
+    void read(long first, long count, double *A) const {
+        for(long i=0; i<count; i++){
+            for(int j=0; j<q; j++){
+                A[i + size_t(j) * count] = x[size_t(first + i) * q + j];
+            }
+        }
+    }
+
+private:
+    const double *x;
+    int q;
+};
+
+inline factor fit(const double *X, const double *y, long m, int p, long block = 4096){
+    matrix_source src(X, y, m, p);
+    return reduce(src, 0, src.rows(), block);
+}
+
+inline factor fit_binary(const std::string &filename, int ncol, long block = 4096){
+    binary_source src(filename, ncol);
+    return reduce(src, 0, src.rows(), block);
+}
+
+// reads 'batch' blocks of text at a time, so memory is batch x block x q
+// doubles
+inline factor fit_csv(const std::string &filename, int ncol, int skip = 0, long block = 4096, long batch = 64){
+    csv_source src(filename, ncol, skip);
+    factor total(ncol);
+    std::vector<double> buf;
+
+    for(;;){
+        long n = src.read_rows(block * batch, buf);
+        if(n == 0){
+            break;
+        }
+        total.merge(reduce(rows_source(buf.data(), ncol), 0, n, block));
+    }
+
+    return total;
+}
+
+}
+
+#endif
@@ -2,6 +2,8 @@
 #include <random>
 #include <iostream>
 
+#include "trace.h"
+
 int main()
 {
     int n_inside = 0;
@@ -17,21 +19,27 @@ int main()
         std::minstd_rand generator(rd());
         std::uniform_real_distribution<> random(-1.0, 1.0);
 
-        #pragma omp for
-        for (int i=0; i<1000000; ++i)
         {
-            double x = random(generator);
-            double y = random(generator);
-
-            double r = std::sqrt( x*x + y*y );
+            // time each thread's share of the loop (compile with -DENABLE_TRACE);
+            // nowait so that the trace shows idle time rather than the barrier
+            TRACE_SCOPE("pi samples");
 
-            if (r < 1.0)
-            {
-                ++pvt_n_inside;
-            }
-            else
+            #pragma omp for nowait
+            for (int i=0; i<1000000; ++i)
             {
-                ++pvt_n_outside;
+                double x = random(generator);
+                double y = random(generator);
+
+                double r = std::sqrt( x*x + y*y );
+
+                if (r < 1.0)
+                {
+                    ++pvt_n_inside;
+                }
+                else
+                {
+                    ++pvt_n_outside;
+                }
             }
         }
 
@@ -6,27 +6,29 @@
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_reduce.h>
 
+#include "numa_alloc.h"
+
 int main(int argc, char **argv)
 {
-    auto values = std::vector<double>(10000);
+    // Pages are not touched until the values are generated below
+    auto values = numa::vector<double>(10000);
+
+    // Split the values between NUMA nodes, with the same threads handling
+    // the same chunks in every pass
+    auto layout = numa::layout(values.size(), sizeof(double));
     
     // Generate values to sum over
-    tbb::parallel_for( tbb::blocked_range<int>(0,values.size()),
-                       [&](tbb::blocked_range<int> r)
+    numa::first_touch(layout, values, [](size_t i)
     {
-        for (int i=r.begin(); i<r.end(); ++i)
-        {
-            values[i] = std::sin(i * 0.001);
-        }
+        return std::sin(i * 0.001);
     });
 
     // Sum the values using parallel_reduce
-    auto total = tbb::parallel_reduce( 
-                    tbb::blocked_range<int>(0,values.size()),
+    auto total = layout.parallel_reduce( 
                     0.0,
-                    [&](tbb::blocked_range<int> r, double running_total)
+                    [&](tbb::blocked_range<size_t> r, double running_total)
                     {
-                        for (int i=r.begin(); i<r.end(); ++i)
+                        for (size_t i=r.begin(); i<r.end(); ++i)
                         {
                             running_total += values[i];
                         }
@@ -36,4 +38,4 @@ int main(int argc, char **argv)
     std::cout << total << std::endl;
 
     return 0;
-}
\ No newline at end of file
+}
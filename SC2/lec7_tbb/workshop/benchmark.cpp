@@ -0,0 +1,232 @@
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include <memory>
+
+#include <tbb/parallel_reduce.h>
+
+#include "part1.h"
+#include "energy.h"
+#include "filecounter.h"
+#include "numa_alloc.h"
+#include "simd_math.h"
+#include "bench.h"
+
+/*  Benchmarks for the workshop kernels, swept over thread counts and
+    problem sizes. Build with
+
+        g++ --std=c++14 -O3 -fopenmp -Iinclude -I../../include benchmark.cpp -ltbb -o benchmark
+
+    and run e.g.
+
+        ./benchmark --quick                          # smallest sizes only
+        ./benchmark --json base.json                 # save a baseline
+        ./benchmark --baseline base.json             # exit 1 on a regression
+        ./benchmark --threads 1,2,4 --filter energy
+*/
+
+using namespace part1;
+
+// results are written here so the compiler can't optimise the work away
+volatile double sink;
+
+/** Estimate pi from 'n' random samples, as in lec6_openmp/pi.cpp but with
+    fixed seeds so each run does the same work */
+double estimate_pi(int n)
+{
+    int n_inside = 0;
+
+    #pragma omp parallel reduction(+:n_inside)
+    {
+#ifdef _OPENMP
+        std::minstd_rand generator(12345 + omp_get_thread_num());
+#else
+        std::minstd_rand generator(12345);
+#endif
+        std::uniform_real_distribution<> random(-1.0, 1.0);
+
+        #pragma omp for
+        for (int i=0; i<n; ++i)
+        {
+            double x = random(generator);
+            double y = random(generator);
+
+            if (std::sqrt(x*x + y*y) < 1.0)
+            {
+                ++n_inside;
+            }
+        }
+    }
+
+    return (4.0 * n_inside) / n;
+}
+
+/** Return the paths of the plays in the shakespeare directory, repeated
+    until there are 'n' of them */
+std::vector<std::string> get_plays(size_t n)
+{
+    static const char *plays[] = { "allswellthatendswell", "antonyandcleopatra", "asyoulikeit",
+                                   "comedyoferrors", "coriolanus", "cymbeline", "hamlet",
+                                   "juliuscaesar", "kinglear" };
+
+    std::vector<std::string> filenames;
+
+    for (size_t i=0; i<n; ++i)
+    {
+        filenames.push_back(std::string("shakespeare/") + plays[i % 9]);
+    }
+
+    return filenames;
+}
+
+int main(int argc, char **argv)
+{
+    bench::suite suite(bench::parse_options(argc, argv));
+
+    suite.add("map/serial", {1000000, 10000000}, [](size_t n)
+    {
+        auto values = std::vector<double>(n, 0.5);
+
+        return bench::timed(n, [=]()
+        {
+            auto result = map([](double x){ return x * x + 1.0; }, values);
+            sink = result.back();
+        });
+    });
+
+    suite.add("reduce/serial", {1000000, 10000000}, [](size_t n)
+    {
+        auto values = std::vector<double>(n, 0.5);
+
+        return bench::timed(n, [=]()
+        {
+            sink = reduce(std::plus<double>(), values);
+        });
+    });
+
+    suite.add("mapreduce/parallel", {1000000, 10000000}, [](size_t n)
+    {
+        auto values = std::vector<double>(n, 0.5);
+
+        return bench::timed(n, [=]()
+        {
+            sink = parallel::mapReduce([](double x){ return x * x + 1.0; },
+                                       std::plus<double>(), values);
+        });
+    });
+
+    suite.add("energy/serial", {1000, 4000}, [](size_t n)
+    {
+        auto group_a = create_random_points(n);
+        auto group_b = create_random_points(n);
+
+        return bench::timed(double(n) * n, [=]()
+        {
+            sink = energy::calculate_energy(group_a, group_b);
+        });
+    });
+
+    suite.add("energy/mapreduce", {1000, 4000}, [](size_t n)
+    {
+        auto group_a = create_random_points(n);
+        auto group_b = create_random_points(n);
+
+        return bench::timed(double(n) * n, [=]()
+        {
+            sink = energy::mapreduce_energy(group_a, group_b);
+        });
+    });
+
+    // elements are files, not lines, as that is what countlines maps over
+    suite.add("countlines/serial", {9, 36}, [](size_t n)
+    {
+        auto filenames = get_plays(n);
+
+        return bench::timed(n, [=]()
+        {
+            auto results = map(filecounter::count_lines, filenames);
+            sink = results.back();
+        });
+    });
+
+    suite.add("countlines/parallel", {9, 36}, [](size_t n)
+    {
+        auto filenames = get_plays(n);
+
+        return bench::timed(n, [=]()
+        {
+            sink = parallel::mapReduce(filecounter::count_lines, std::plus<int>(), filenames);
+        });
+    });
+
+    suite.add("pi/openmp", {1000000, 10000000}, [](size_t n)
+    {
+        return bench::timed(n, [=]()
+        {
+            sink = estimate_pi(static_cast<int>(n));
+        });
+    });
+
+    suite.add("reduce/numa", {1000000, 10000000}, [](size_t n)
+    {
+        auto values = std::make_shared<numa::vector<double>>(n);
+        auto layout = std::make_shared<numa::layout>(n, sizeof(double));
+
+        numa::first_touch(*layout, *values, [](size_t i)
+        {
+            return std::sin(i * 0.001);
+        });
+
+        return bench::timed(n, [=]()
+        {
+            const double *v = values->data();
+
+            sink = layout->parallel_reduce(0.0,
+                        [=](tbb::blocked_range<size_t> r, double running_total)
+                        {
+                            for (size_t i=r.begin(); i<r.end(); ++i)
+                            {
+                                running_total += v[i];
+                            }
+
+                            return running_total;
+                        }, std::plus<double>());
+        });
+    });
+
+    suite.add("reduce/simd_sin", {1000000, 10000000}, [](size_t n)
+    {
+        return bench::timed(n, [=]()
+        {
+            sink = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, n), 0.0,
+                        [](tbb::blocked_range<size_t> r, double running_total)
+                        {
+                            const size_t blocksize = 256;
+                            double values[blocksize];
+
+                            for (size_t start=r.begin(); start<r.end(); start+=blocksize)
+                            {
+                                const size_t m = std::min(blocksize, r.end() - start);
+
+                                for (size_t i=0; i<m; ++i)
+                                {
+                                    values[i] = (start + i) * 0.001;
+                                }
+
+                                sm_sin(values, values, m);
+
+                                for (size_t i=0; i<m; ++i)
+                                {
+                                    running_total += values[i];
+                                }
+                            }
+
+                            return running_total;
+                        }, std::plus<double>());
+        });
+    });
+
+    return (suite.run() != 0) ? 1 : 0;
+}
@@ -1,5 +1,6 @@
 #include "part1.h"
 #include "filecounter.h"
+#include "perfcounters.h"
 
 using namespace part1;
 using namespace filecounter;
@@ -8,7 +9,11 @@ int main(int argc, char **argv)
 {
     auto filenames = get_arguments(argc, argv);
 
-    auto results = map( count_lines, filenames );
+    std::vector<int> results;
+    {
+        perf::region region("count_lines", filenames.size());
+        results = map( count_lines, filenames );
+    }
 
     for (size_t i=0; i<filenames.size(); ++i)
     {
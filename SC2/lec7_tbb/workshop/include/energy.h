@@ -0,0 +1,54 @@
+#ifndef energy_h
+#define energy_h
+
+#include "part1.h"
+#include <functional>
+
+namespace energy
+{
+
+using part1::Point;
+
+/** This function calculates the interaction energy between two points */
+double calculate_energy(const Point &point1,
+                        const Point &point2)
+{
+    return 1.0 / (0.1 + part1::calc_distance(point1, point2));
+}
+
+/** This function calculates the total energy between two groups of points */
+double calculate_energy(const std::vector<Point> &group1,
+                        const std::vector<Point> &group2)
+{
+    double total = 0;
+
+    for (const Point &point1 : group1)
+    {
+        for (const Point &point2 : group2)
+        {
+            total += calculate_energy(point1, point2);
+        }
+    }
+
+    return total;
+}
+
+/** This function calculates the total energy between two groups of points
+    using a nested parallel map/reduce */
+double mapreduce_energy(const std::vector<Point> &group1,
+                        const std::vector<Point> &group2)
+{
+    return part1::parallel::mapReduce( [=](const Point &point1)
+                      {
+                          return part1::parallel::mapReduce([=](const Point &point2)
+                          {
+                              return calculate_energy(point1, point2);
+                          },
+                          std::plus<double>(), group2 );
+                      },
+                      std::plus<double>(), group1 );
+}
+
+} // end of namespace energy
+
+#endif
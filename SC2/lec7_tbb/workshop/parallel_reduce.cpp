@@ -2,44 +2,45 @@
 #include <vector>
 #include <cmath>
 #include <algorithm>
-#include <mutex>
 
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_reduce.h>
 
+#include "numa_alloc.h"
+#include "trace.h"
+#include "perfcounters.h"
+
 int main(int argc, char **argv)
 {
-    auto values = std::vector<double>(10000);
+    auto values = numa::vector<double>(10000);
+    auto layout = numa::layout(values.size(), sizeof(double));
     
-    tbb::parallel_for( tbb::blocked_range<int>(0,values.size()),
-                       [&](tbb::blocked_range<int> r)
+    numa::first_touch(layout, values, [](size_t i)
     {
-        for (int i=r.begin(); i<r.end(); ++i)
-        {
-            values[i] = std::sin(i * 0.001);
-        }
+        return std::sin(i * 0.001);
     });
 
-    std::mutex m;
+    // report counters for the reduction pass (one element per value)
+    double total;
+    {
+        perf::region region("reduce", values.size());
 
-    auto total = tbb::parallel_reduce( 
-                    tbb::blocked_range<int>(0,values.size()),
-                    0.0,
-                    [&](tbb::blocked_range<int> r, double running_total)
-                    {
-                        for (int i=r.begin(); i<r.end(); ++i)
+        total = layout.parallel_reduce( 
+                        0.0,
+                        [&](tbb::blocked_range<size_t> r, double running_total)
                         {
-                            running_total += values[i];
-                        }
-
-                        m.lock();
-                        std::cout << "Total now = " << running_total
-                                  << " from iterations " << r.begin()
-                                  << " to " << r.end() << std::endl;
-                        m.unlock();
-
-                        return running_total;
-                    }, std::plus<double>() );
+                            // record which thread reduced which range (compile
+                            // with -DENABLE_TRACE and open trace.json in Perfetto)
+                            TRACE_RANGE("reduce", r.begin(), r.end());
+
+                            for (size_t i=r.begin(); i<r.end(); ++i)
+                            {
+                                running_total += values[i];
+                            }
+
+                            return running_total;
+                        }, std::plus<double>() );
+    }
 
     std::cout << total << std::endl;
 
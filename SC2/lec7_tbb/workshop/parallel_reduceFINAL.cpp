@@ -1,9 +1,12 @@
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_reduce.h>
 
+#include "simd_math.h"
+
 int main(int argc, char **argv)
 {
     auto total = tbb::parallel_reduce( 
@@ -11,9 +14,25 @@ int main(int argc, char **argv)
                   0.0,
                   [](tbb::blocked_range<int> r, double running_total)
     {
-        for (int i=r.begin(); i<r.end(); ++i)
+        // evaluate sin a block at a time with the vectorised kernel
+        const int blocksize = 256;
+        double values[blocksize];
+
+        for (int start=r.begin(); start<r.end(); start+=blocksize)
         {
-            running_total += std::sin(i * 0.001);
+            const int n = std::min(blocksize, r.end() - start);
+
+            for (int i=0; i<n; ++i)
+            {
+                values[i] = (start + i) * 0.001;
+            }
+
+            sm_sin(values, values, n);
+
+            for (int i=0; i<n; ++i)
+            {
+                running_total += values[i];
+            }
         }
 
         return running_total;
@@ -22,4 +41,4 @@ int main(int argc, char **argv)
     std::cout << total << std::endl;
 
     return 0;
-}
\ No newline at end of file
+}
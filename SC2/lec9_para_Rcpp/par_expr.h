@@ -0,0 +1,338 @@
+#ifndef par_expr_h
+#define par_expr_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+
+// element-wise expressions over vectors of doubles, evaluated in a single
+// parallel pass. Arithmetic on vectors builds a (small) object describing
+// the expression instead of computing anything, and the loop is only run
+// when the expression is assigned or reduced:
+//
+//     pexpr::view x(xv), y(yv);                  // NumericVector, RVector, std::vector...
+//     pexpr::out(output) = x * x + 2.0 * y;      // one loop, no temporaries
+//     double p = pexpr::sum(x * y);              // dot product, join derived from sum
+//
+// Each assignment or reduction is one Worker with the whole expression
+// inlined into its loop, so there is no temporary vector and no extra pass
+// over memory per operation, and the loop body is plain indexing that the
+// compiler can vectorise. Reductions take their join from the operation
+// (sum, min, max), so they need no hand-written Worker either.
+//
+// Include RcppParallel.h first to run the Workers with RcppParallel
+// (parallelFor / parallelReduce, honouring setThreadOptions); otherwise
+// they run on TBB directly
+#ifdef __RCPP_PARALLEL__
+#define PEXPR_RCPP_PARALLEL 1
+#else
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#endif
+
+namespace pexpr {
+
+// vectors shorter than this are done in one thread: below it starting the
+// threads costs more than the loop
+const std::size_t serial_below = 1 << 15;
+
+// elements per task
+const std::size_t grain = 1 << 13;
+
+// the size of a scalar: it fits any length, including 0
+const std::size_t any_size = std::numeric_limits<std::size_t>::max();
+
+// base of every expression: E is the expression type itself
+template <class E>
+struct expr {
+    const E& self() const { return static_cast<const E&>(*this); }
+};
+
+// the data of anything with contiguous begin() and end(): NumericVector,
+// RVector<double>, std::vector<double>
+template <class C>
+const double* data_of(const C &c){
+    return (c.end() == c.begin()) ? nullptr : &*c.begin();
+}
+
+template <class C>
+double* data_of(C &c){
+    return (c.end() == c.begin()) ? nullptr : &*c.begin();
+}
+
+// a read-only vector: a pointer and a length
+struct view : expr<view> {
+    const double *p;
+    std::size_t n;
+
+    view(const double *p, std::size_t n) : p(p), n(n) {}
+
+    template <class C>
+    view(const C &c) : p(data_of(c)), n(c.end() - c.begin()) {}
+
+    double operator[](std::size_t i) const { return p[i]; }
+    std::size_t size() const { return n; }
+};
+
+// a number, repeated to whatever length it is used at (size any_size)
+struct scalar : expr<scalar> {
+    double v;
+
+    scalar(double v) : v(v) {}
+
+    double operator[](std::size_t) const { return v; }
+    std::size_t size() const { return any_size; }
+};
+
+// the length of two operands, scalars fitting anything. Empty vectors are
+// checked like any other, so they only combine with empty vectors and scalars
+inline std::size_t common_size(std::size_t a, std::size_t b){
+    if(a == any_size){
+        return b;
+    }
+    if(b != any_size && a != b){
+        throw std::invalid_argument("vectors of different lengths in an expression");
+    }
+    return a;
+}
+
+template <class OP, class L, class R>
+struct binary : expr<binary<OP, L, R> > {
+    L l;
+    R r;
+    std::size_t n;
+
+    binary(const L &l, const R &r) : l(l), r(r), n(common_size(l.size(), r.size())) {}
+
+    double operator[](std::size_t i) const { return OP::apply(l[i], r[i]); }
+    std::size_t size() const { return n; }
+};
+
+template <class OP, class E>
+struct unary : expr<unary<OP, E> > {
+    E e;
+
+    unary(const E &e) : e(e) {}
+
+    double operator[](std::size_t i) const { return OP::apply(e[i]); }
+    std::size_t size() const { return e.size(); }
+};
+
+struct add_op { static double apply(double a, double b){ return a + b; } };
+struct sub_op { static double apply(double a, double b){ return a - b; } };
+struct mul_op { static double apply(double a, double b){ return a * b; } };
+struct div_op { static double apply(double a, double b){ return a / b; } };
+
+struct neg_op { static double apply(double a){ return -a; } };
+struct abs_op { static double apply(double a){ return std::fabs(a); } };
+struct sqrt_op { static double apply(double a){ return std::sqrt(a); } };
+struct exp_op { static double apply(double a){ return std::exp(a); } };
+struct log_op { static double apply(double a){ return std::log(a); } };
+
+// the operators, for expression op expression, expression op number and number op expression
+#define PEXPR_BINARY(NAME, OP)                                                      \
+    template <class L, class R>                                                     \
+    binary<OP, L, R> NAME(const expr<L> &l, const expr<R> &r){                      \
+        return binary<OP, L, R>(l.self(), r.self());                                \
+    }                                                                               \
+    template <class L>                                                              \
+    binary<OP, L, scalar> NAME(const expr<L> &l, double r){                         \
+        return binary<OP, L, scalar>(l.self(), scalar(r));                          \
+    }                                                                               \
+    template <class R>                                                              \
+    binary<OP, scalar, R> NAME(double l, const expr<R> &r){                         \
+        return binary<OP, scalar, R>(scalar(l), r.self());                          \
+    }
+
+PEXPR_BINARY(operator+, add_op)
+PEXPR_BINARY(operator-, sub_op)
+PEXPR_BINARY(operator*, mul_op)
+PEXPR_BINARY(operator/, div_op)
+
+#undef PEXPR_BINARY
+
+#define PEXPR_UNARY(NAME, OP)                                                       \
+    template <class E>                                                              \
+    unary<OP, E> NAME(const expr<E> &e){                                            \
+        return unary<OP, E>(e.self());                                              \
+    }
+
+PEXPR_UNARY(operator-, neg_op)
+PEXPR_UNARY(abs, abs_op)
+PEXPR_UNARY(sqrt, sqrt_op)
+PEXPR_UNARY(exp, exp_op)
+PEXPR_UNARY(log, log_op)
+
+#undef PEXPR_UNARY
+
+#ifdef PEXPR_RCPP_PARALLEL
+typedef RcppParallel::Worker worker_base;
+typedef RcppParallel::Split split_tag;
+#else
+struct worker_base {};
+typedef tbb::split split_tag;
+#endif
+
+// out[i] = e[i]
+template <class E>
+struct assign_worker : public worker_base {
+    double *out;
+    E e;
+
+    assign_worker(double *out, const E &e) : out(out), e(e) {}
+
+    void operator()(std::size_t begin, std::size_t end){
+        for(std::size_t i=begin; i<end; i++){
+            out[i] = e[i];
+        }
+    }
+};
+
+// the reductions: an identity and an associative combination. The join of
+// the Worker is the combination, applied to the two partial results
+struct sum_op {
+    static double identity(){ return 0.0; }
+    static double combine(double a, double b){ return a + b; }
+};
+
+struct min_op {
+    static double identity(){ return std::numeric_limits<double>::infinity(); }
+    static double combine(double a, double b){ return std::min(a, b); }
+};
+
+struct max_op {
+    static double identity(){ return -std::numeric_limits<double>::infinity(); }
+    static double combine(double a, double b){ return std::max(a, b); }
+};
+
+template <class OP, class E>
+struct reduce_worker : public worker_base {
+    E e;
+    double value;
+
+    reduce_worker(const E &e) : e(e), value(OP::identity()) {}
+    reduce_worker(const reduce_worker &w, split_tag) : e(w.e), value(OP::identity()) {}
+
+    // four partial results, so each combination doesn't wait on the last
+    void operator()(std::size_t begin, std::size_t end){
+        double v0 = OP::identity(), v1 = v0, v2 = v0, v3 = v0;
+        std::size_t i = begin;
+        for(; i + 4 <= end; i += 4){
+            v0 = OP::combine(v0, e[i]);
+            v1 = OP::combine(v1, e[i + 1]);
+            v2 = OP::combine(v2, e[i + 2]);
+            v3 = OP::combine(v3, e[i + 3]);
+        }
+        for(; i<end; i++){
+            v0 = OP::combine(v0, e[i]);
+        }
+        value = OP::combine(value, OP::combine(OP::combine(v0, v1), OP::combine(v2, v3)));
+    }
+
+#ifndef PEXPR_RCPP_PARALLEL
+    void operator()(const tbb::blocked_range<std::size_t> &range){
+        (*this)(range.begin(), range.end());
+    }
+#endif
+
+    void join(const reduce_worker &rhs){
+        value = OP::combine(value, rhs.value);
+    }
+};
+
+template <class W>
+void run_for(std::size_t n, W &w){
+    if(n < serial_below){
+        w(0, n);
+        return;
+    }
+#ifdef PEXPR_RCPP_PARALLEL
+    RcppParallel::parallelFor(0, n, w, grain);
+#else
+    tbb::parallel_for(tbb::blocked_range<std::size_t>(0, n, grain), [&](const tbb::blocked_range<std::size_t> &range){
+        w(range.begin(), range.end());
+    });
+#endif
+}
+
+template <class W>
+void run_reduce(std::size_t n, W &w){
+    if(n < serial_below){
+        w(0, n);
+        return;
+    }
+#ifdef PEXPR_RCPP_PARALLEL
+    RcppParallel::parallelReduce(0, n, w, grain);
+#else
+    tbb::parallel_reduce(tbb::blocked_range<std::size_t>(0, n, grain), w);
+#endif
+}
+
+// reduce the elements of an expression with OP. A bare number has no
+// length, so it can't be reduced
+template <class OP, class E>
+double reduce(const expr<E> &e){
+    if(e.self().size() == any_size){
+        throw std::invalid_argument("an expression of scalars has no length to reduce over");
+    }
+    reduce_worker<OP, E> w(e.self());
+    run_reduce(e.self().size(), w);
+    return w.value;
+}
+
+template <class E>
+double sum(const expr<E> &e){ return reduce<sum_op>(e); }
+
+template <class E>
+double min(const expr<E> &e){ return reduce<min_op>(e); }
+
+template <class E>
+double max(const expr<E> &e){ return reduce<max_op>(e); }
+
+template <class L, class R>
+double dot(const expr<L> &l, const expr<R> &r){ return sum(l * r); }
+
+// a vector to write to: assigning an expression evaluates it into the
+// vector in one pass. The expression may use the vector itself (x = 2 * x),
+// as each element only depends on the same element of the operands
+struct out_view : expr<out_view> {
+    double *p;
+    std::size_t n;
+
+    out_view(double *p, std::size_t n) : p(p), n(n) {}
+
+    // assigning another out_view copies its elements, not the pointer
+    out_view& operator=(const out_view &o){
+        return *this = view(o.p, o.n);
+    }
+
+    template <class E>
+    out_view& operator=(const expr<E> &e){
+        common_size(n, e.self().size());
+        assign_worker<E> w(p, e.self());
+        run_for(n, w);
+        return *this;
+    }
+
+    out_view& operator=(double v){
+        return *this = scalar(v);
+    }
+
+    template <class E>
+    out_view& operator+=(const expr<E> &e){
+        return *this = view(p, n) + e.self();
+    }
+
+    double operator[](std::size_t i) const { return p[i]; }
+    std::size_t size() const { return n; }
+};
+
+template <class C>
+out_view out(C &c){ return out_view(data_of(c), c.end() - c.begin()); }
+
+}
+
+#endif